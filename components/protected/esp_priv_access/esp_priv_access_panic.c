@@ -20,6 +20,7 @@
 #include "soc/soc.h"
 #include "esp_rom_uart.h"
 #include "esp_priv_access.h"
+#include "soc_defs.h"
 #include "esp_private/system_internal.h"
 #if CONFIG_IDF_TARGET_ARCH_RISCV
 #include "riscv/rvruntime-frames.h"
@@ -37,6 +38,10 @@ static __attribute__((unused)) const char *TAG = "esp_priv_access_panic";
 static bool _is_task_wdt_timeout;
 static uint32_t _task_wdt_user_epc;
 
+#if CONFIG_ESP_SYSCALL_LOG_RING
+extern void esp_log_ring_panic_flush(void);
+#endif
+
 #if CONFIG_IDF_TARGET_ARCH_RISCV
 static const char *reason[] = {
     "Instruction address misaligned",
@@ -170,6 +175,10 @@ IRAM_ATTR void esp_priv_access_handle_crashed_task(void)
 #endif
 
     esp_priv_access_int_t intr = esp_priv_access_get_int_status();
+#if CONFIG_ESP_SYSCALL_LOG_RING
+    /* Write the logs user app printed before crashing */
+    esp_log_ring_panic_flush();
+#endif
     ets_printf("\n=================================================\n");
     ets_printf("User app exception occurred:\n");
     if (intr != 0) {
@@ -240,7 +249,7 @@ void esp_task_wdt_isr_user_handler(void)
 {
     StaticTask_t *handle = xTaskGetCurrentTaskHandle();
 
-    if (pvTaskGetThreadLocalStoragePointer(handle, 1) != NULL) {
+    if (pvTaskGetThreadLocalStoragePointer(handle, ESP_PA_TLS_OFFSET_USER_TASK) != NULL) {
 #if CONFIG_PA_USER_TASK_WDT_PANIC
         /* This indicates that its a user space task.
          * Change the return address to a crashing function, which results in user space exception
@@ -580,7 +580,7 @@ static void suspend_user_tasks()
     uint32_t count = uxTaskGetSnapshotAll(snapshots, task_count, &tcb_size);
     for (int i = 0; i < count; i++) {
         handle = (TaskHandle_t)snapshots[i].pxTCB;
-        if (pvTaskGetThreadLocalStoragePointer(handle, ESP_PA_TLS_OFFSET_KERN_STACK) == NULL) {
+        if (pvTaskGetThreadLocalStoragePointer(handle, ESP_PA_TLS_OFFSET_USER_TASK) == NULL) {
             // This indicates that its a protected space task.
             // Keep it as it is
             continue;
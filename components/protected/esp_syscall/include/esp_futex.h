@@ -0,0 +1,96 @@
+// Copyright 2020-2022 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//         http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stdint.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "syscall_structs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Block the calling task while a futex word holds the expected value
+ *
+ * The value is compared and the task queued atomically with respect to esp_futex_wake(),
+ * so a wake up issued after the futex word was changed is never missed.
+ *
+ * @param uaddr Futex word, already validated to be in user app memory
+ * @param val Expected value
+ * @param timeout Maximum time to block, in ticks, portMAX_DELAY to block indefinitely
+ *
+ * @return
+ *      - 0 if woken up by esp_futex_wake()
+ *      - -1 if the futex word does not hold val or if the timeout expired
+ */
+int esp_futex_wait(volatile uint32_t *uaddr, uint32_t val, TickType_t timeout);
+
+/**
+ * @brief Wake up tasks blocked on a futex word, in the order they blocked
+ *
+ * If task_woken is NULL, a woken up task with a higher priority than the calling task is
+ * scheduled before returning. Otherwise, task_woken is set to pdTRUE instead, as
+ * xSemaphoreGiveFromISR() does, and the calling task never yields.
+ *
+ * @param uaddr Futex word
+ * @param count Maximum number of tasks to wake up
+ * @param task_woken Set to pdTRUE if a higher priority task was woken up, or NULL
+ *
+ * @return Number of tasks woken up
+ */
+int esp_futex_wake(volatile uint32_t *uaddr, uint32_t count, BaseType_t *task_woken);
+
+/**
+ * @brief Take the mutex held in a futex word, blocking while another task holds it
+ *
+ * The futex word holds the user task handle of the holder of the mutex, 0 when it is free, along
+ * with ESP_FUTEX_WAITERS. While blocked, the calling task lends its priority to the holder.
+ *
+ * @param uaddr Futex word, already validated to be in user app memory
+ * @param owner User task handle of the calling task
+ * @param timeout Maximum time to block, in ticks, portMAX_DELAY to block indefinitely
+ *
+ * @return
+ *      - 0 once the mutex is taken
+ *      - -1 if the timeout expired
+ */
+int esp_futex_lock_pi(volatile uint32_t *uaddr, uint32_t owner, TickType_t timeout);
+
+/**
+ * @brief Release the mutex held in a futex word to the highest priority task blocked on it
+ *
+ * The priority the calling task inherited from the blocked tasks is dropped.
+ *
+ * @param uaddr Futex word, already validated to be in user app memory
+ * @param owner User task handle of the calling task
+ *
+ * @return
+ *      - 0 on success
+ *      - -1 if the calling task does not hold the mutex
+ */
+int esp_futex_unlock_pi(volatile uint32_t *uaddr, uint32_t owner);
+
+/**
+ * @brief Forget a deleted task blocked on a futex word
+ *
+ * @param task Deleted task
+ */
+void esp_futex_task_deleted(TaskHandle_t task);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,41 @@
+// Copyright 2020-2022 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//         http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Allocate kernel stacks until the pool holds CONFIG_ESP_SYSCALL_KERNEL_STACK_POOL_SPARE free stacks
+ *
+ * Must be called from task context. The system call handler calls it, with interrupts enabled,
+ * when a system call leaves fewer free stacks than that in the pool.
+ */
+void esp_kernel_stack_pool_refill(void);
+
+/**
+ * @brief Give a kernel stack back to the pool
+ *
+ * Used when a task is deleted while it executes a system call, so it never returns the
+ * kernel stack it holds.
+ *
+ * @param stack Kernel stack
+ */
+void esp_kernel_stack_pool_put(void *stack);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,63 @@
+// Copyright 2020-2022 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//         http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "esp_err.h"
+#include "syscall_structs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Drain the log ring of user app to the console
+ *
+ * The ring is initialized and then drained by a protected task, until esp_log_ring_unregister
+ * is called. Only one ring can be registered at a time.
+ *
+ * @param ring Log ring, in user app memory
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the ring is not in user app memory or is misaligned
+ *      - ESP_ERR_INVALID_STATE if a ring is already registered
+ *      - ESP_ERR_NO_MEM if the drainer task could not be created
+ */
+esp_err_t esp_log_ring_register(esp_log_ring_t *ring);
+
+/**
+ * @brief Write the pending records of the log ring to the console
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_STATE if no ring is registered
+ */
+esp_err_t esp_log_ring_flush(void);
+
+/**
+ * @brief Write the pending records of the log ring from the user app panic handler
+ *
+ * Records are written with ets_printf, without taking any lock.
+ */
+void esp_log_ring_panic_flush(void);
+
+/**
+ * @brief Write the pending records and stop draining the log ring registered by user app
+ */
+void esp_log_ring_unregister(void);
+
+#ifdef __cplusplus
+}
+#endif
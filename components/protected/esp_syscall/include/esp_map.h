@@ -14,6 +14,8 @@
 
 #pragma once
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -26,28 +28,109 @@ extern "C" {
 #define ESP_MAP_ESP_NETIF_ID    0xF5A6
 #define ESP_MAP_GPIO_ID         0xF5A7
 
-// Uncomment to enable CRC verification in esp_map layer
-//#define ESP_MAP_ENABLE_CRC  1
+/*
+ * Handle returned to user app is encoded as below:
+ *
+ * |  31 - 28  |     27 - 16      |            15 - 0             |
+ * |-----------|------------------|-------------------------------|
+ * |     0     | Slot generation  | Slot + ESP_MAP_INDEX_OFFSET   |
+ *
+ * Generation of a slot is incremented every time the slot is released, so a stale
+ * handle to a removed resource is rejected even if its slot has been reused.
+ */
+#define ESP_MAP_INDEX_OFFSET    1024
+#define ESP_MAP_INDEX_MASK      0xFFFF
+#define ESP_MAP_GEN_SHIFT       16
+#define ESP_MAP_GEN_MASK        0xFFF
+#define ESP_MAP_MAX_HANDLES     (ESP_MAP_INDEX_MASK + 1 - ESP_MAP_INDEX_OFFSET)
+
+#define ESP_MAP_MAKE_INDEX(slot, gen)   ((((gen) & ESP_MAP_GEN_MASK) << ESP_MAP_GEN_SHIFT) | ((slot) + ESP_MAP_INDEX_OFFSET))
+#define ESP_MAP_INDEX_TO_SLOT(x)        (((x) & ESP_MAP_INDEX_MASK) - ESP_MAP_INDEX_OFFSET)
+#define ESP_MAP_INDEX_TO_GEN(x)         (((x) >> ESP_MAP_GEN_SHIFT) & ESP_MAP_GEN_MASK)
 
-#define ESP_MAP_INDEX_OFFSET 1024
 #define ESP_MAP_GET_RAW_HANDLE(x) ((x)->handle)
 #define ESP_MAP_GET_ID(x) ((x)->id)
 
 typedef struct {
     uint16_t id;    // Handle type identifier
+    uint16_t gen;   // Generation of the slot holding this handle
     void *handle;   // Handle returned by protected APIs
-#ifdef ESP_MAP_ENABLE_CRC
-    uint16_t crc;   // CRC of identifier and protected handle
-#endif
 } esp_map_handle_t;
 
+/**
+ * @brief Callback invoked by esp_map_for_each_type for each handle
+ *
+ * @param wrapper_index Index of the handle, as returned by esp_map_add
+ * @param wrapper_handle Handle wrapper
+ * @param arg User argument passed to esp_map_for_each_type
+ */
+typedef void (*esp_map_iter_cb_t)(int wrapper_index, esp_map_handle_t *wrapper_handle, void *arg);
+
 void esp_map_init(void);
 int esp_map_add(void *handle, int type);
 esp_map_handle_t *esp_map_verify(int wrapper_index, int type);
+
+/**
+ * @brief Verify a handle from an ISR or a critical section
+ *
+ * Same as esp_map_verify, but it is placed in IRAM and can be called from any context.
+ *
+ * @param wrapper_index Index of the handle, as returned by esp_map_add
+ * @param type Type identifier of the handle
+ *
+ * @return Handle wrapper or NULL if the index is not valid for the type
+ */
+esp_map_handle_t *esp_map_verify_from_isr(int wrapper_index, int type);
+
 void esp_map_remove(int wrapper_index);
 esp_map_handle_t *esp_map_get_handle(int wrapper_index);
 int esp_map_get_allocated_size(void);
 
+/**
+ * @brief Find the index of a protected handle added to esp_map
+ *
+ * @param ptr Protected handle, as passed to esp_map_add
+ * @param type Type identifier of the handle, 0 to match any type
+ *
+ * @return Index of the handle, 0 if it is not present
+ */
+int esp_map_lookup_by_ptr(const void *ptr, int type);
+
+/**
+ * @brief Invoke a callback for every handle of a type
+ *
+ * esp_map lock is held while walking the handles, so the callback can remove the handle
+ * it is invoked for, but must not remove any other handle. It must not delete the resource
+ * either, as the deletion of a task makes the idle task wait for esp_map lock: collect the
+ * handles and delete their resources once this function returns.
+ *
+ * @param type Type identifier of the handles, 0 for all the handles
+ * @param cb Callback
+ * @param arg User argument passed to the callback
+ */
+void esp_map_for_each_type(int type, esp_map_iter_cb_t cb, void *arg);
+
+/**
+ * @brief Get the occupancy of esp_map
+ *
+ * @param used_handles Set to the number of handles in use
+ * @param total_handles Set to the number of handles that fit in the allocated pages
+ * @param memory_size Set to the memory used by esp_map, in bytes
+ */
+void esp_map_get_usage(int *used_handles, int *total_handles, int *memory_size);
+
+struct esp_map_stats;
+
+/**
+ * @brief Get esp_map statistics
+ *
+ * Counters are only collected when CONFIG_ESP_SYSCALL_MAP_STATS is enabled, otherwise only
+ * the occupancy fields are filled.
+ *
+ * @param stats Statistics, see esp_map_stats_t in syscall_structs.h
+ */
+void esp_map_get_stats(struct esp_map_stats *stats);
+
 #ifdef __cplusplus
 }
 #endif
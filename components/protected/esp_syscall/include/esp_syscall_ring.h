@@ -0,0 +1,44 @@
+// Copyright 2020-2022 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//         http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stdint.h>
+#include "syscall_structs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Execute the system calls queued by user app in a ring
+ *
+ * Submissions are executed in order on the calling task, and the result of each one is
+ * posted to the completion queue of the ring before the next one is executed, so all the
+ * completions are posted when this function returns. A submission that blocks (e.g. a queue
+ * receive with a timeout) blocks the following ones.
+ *
+ * @param ring Ring, in user app memory
+ * @param to_submit Number of submissions to execute
+ *
+ * @return
+ *      - Number of submissions consumed. It is lower than requested if the submission
+ *        queue is empty or if the completion queue is full
+ *      - -1 if the ring is not in user app memory or its indices are corrupted
+ */
+int esp_syscall_ring_enter(esp_syscall_ring_t *ring, uint32_t to_submit);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,59 @@
+// Copyright 2020-2022 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//         http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "syscall_structs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Account a system call that just returned
+ *
+ * Called by the system call handler after every system call.
+ *
+ * @param nr System call number
+ * @param start_cycles CPU cycle count when the system call was entered
+ */
+void esp_syscall_trace_record(uint32_t nr, uint32_t start_cycles);
+
+/**
+ * @brief Get the latency statistics of a system call number
+ *
+ * @param index Index of the statistics, from 0 up to the number of system call numbers called so far
+ * @param stats Statistics
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_NOT_FOUND if index is past the last system call number called so far
+ */
+esp_err_t esp_syscall_trace_get_stats(uint32_t index, esp_syscall_trace_stats_t *stats);
+
+/**
+ * @brief Get the most recent system calls
+ *
+ * @param records Records, oldest first
+ * @param max_records Size of records
+ *
+ * @return Number of records copied
+ */
+int esp_syscall_trace_get_records(esp_syscall_trace_record_t *records, uint32_t max_records);
+
+#ifdef __cplusplus
+}
+#endif
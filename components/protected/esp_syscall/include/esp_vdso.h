@@ -0,0 +1,47 @@
+// Copyright 2020-2022 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//         http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "esp_err.h"
+#include "syscall_structs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Publish time and tick count to user app
+ *
+ * The page is initialized and then updated by protected app at every tick, until
+ * esp_vdso_unregister is called. Only one page can be registered at a time.
+ *
+ * @param vdso Data page, in user app memory
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the page is not in user app memory or is misaligned
+ *      - ESP_ERR_INVALID_STATE if a page is already registered
+ *      - ESP_ERR_NO_MEM if the tick hooks could not be registered
+ */
+esp_err_t esp_vdso_register(esp_vdso_data_t *vdso);
+
+/**
+ * @brief Stop updating the data page registered by user app
+ */
+void esp_vdso_unregister(void);
+
+#ifdef __cplusplus
+}
+#endif
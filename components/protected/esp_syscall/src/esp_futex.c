@@ -0,0 +1,298 @@
+// Copyright 2020-2022 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//         http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <esp_attr.h>
+#include "esp_map.h"
+#include "esp_futex.h"
+
+#define FUTEX_HASH_BUCKETS      16
+
+/*
+ * futex_disinherit_after_timeout() accounts for a futex in the held mutex count of the holder through
+ * StaticTask_t, which mirrors the TCB of FreeRTOS 10: uxDummy12 holds uxBasePriority and uxMutexesHeld.
+ */
+_Static_assert(tskKERNEL_VERSION_MAJOR == 10, "esp_futex depends on the TCB layout of FreeRTOS 10");
+_Static_assert(configUSE_MUTEXES == 1, "esp_futex priority inheritance requires configUSE_MUTEXES");
+_Static_assert(sizeof(((StaticTask_t *)0)->uxDummy12) == 2 * sizeof(UBaseType_t), "uxDummy12 must mirror uxBasePriority and uxMutexesHeld");
+_Static_assert(offsetof(StaticTask_t, uxDummy12) % sizeof(UBaseType_t) == 0, "uxDummy12 must mirror uxBasePriority and uxMutexesHeld");
+
+/*
+ * Tasks blocked on a futex word are queued in a hash bucket of the address, in a waiter allocated
+ * on their kernel stack, which holds the binary semaphore the task blocks on. The waiter is unlinked
+ * and its semaphore given while holding futex_lock, so that it is never accessed after the task
+ * returns from esp_futex_wait(), which only happens once woken up.
+ *
+ * A mutex futex word holds the user task handle of its holder. A task blocking on it raises the
+ * priority of the holder with the FreeRTOS priority inheritance, and sets ESP_FUTEX_WAITERS so that
+ * the holder releases it through esp_futex_unlock_pi(), which drops the inherited priority. A waiter
+ * timing out lowers it to the priority of the remaining waiters.
+ */
+typedef struct esp_futex_waiter {
+    struct esp_futex_waiter *next;
+    volatile uint32_t *uaddr;
+    TaskHandle_t task;
+    SemaphoreHandle_t sem;
+    StaticSemaphore_t sem_buffer;
+} esp_futex_waiter_t;
+
+static esp_futex_waiter_t *futex_buckets[FUTEX_HASH_BUCKETS];
+static portMUX_TYPE futex_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static inline esp_futex_waiter_t **futex_bucket(volatile uint32_t *uaddr)
+{
+    return &futex_buckets[((uint32_t)uaddr >> 2) % FUTEX_HASH_BUCKETS];
+}
+
+IRAM_ATTR int esp_futex_wait(volatile uint32_t *uaddr, uint32_t val, TickType_t timeout)
+{
+    esp_futex_waiter_t waiter = {
+        .uaddr = uaddr,
+        .task = xTaskGetCurrentTaskHandle(),
+    };
+    esp_futex_waiter_t **link;
+
+    waiter.sem = xSemaphoreCreateBinaryStatic(&waiter.sem_buffer);
+
+    portENTER_CRITICAL(&futex_lock);
+    if (*uaddr != val) {
+        portEXIT_CRITICAL(&futex_lock);
+        return -1;
+    }
+    for (link = futex_bucket(uaddr); *link; link = &(*link)->next) {
+    }
+    *link = &waiter;
+    portEXIT_CRITICAL(&futex_lock);
+
+    if (xSemaphoreTake(waiter.sem, timeout) == pdTRUE) {
+        return 0;
+    }
+
+    /* Timed out, unlink the waiter unless esp_futex_wake() raced with the timeout */
+    portENTER_CRITICAL(&futex_lock);
+    for (link = futex_bucket(uaddr); *link; link = &(*link)->next) {
+        if (*link == &waiter) {
+            *link = waiter.next;
+            portEXIT_CRITICAL(&futex_lock);
+            return -1;
+        }
+    }
+    portEXIT_CRITICAL(&futex_lock);
+    /* esp_futex_wake() unlinked the waiter and gave its semaphore, it is not accessed anymore */
+    return 0;
+}
+
+IRAM_ATTR int esp_futex_wake(volatile uint32_t *uaddr, uint32_t count, BaseType_t *task_woken)
+{
+    esp_futex_waiter_t **link = futex_bucket(uaddr);
+    BaseType_t yield = pdFALSE;
+    uint32_t woken = 0;
+
+    portENTER_CRITICAL(&futex_lock);
+    while (*link && woken < count) {
+        esp_futex_waiter_t *waiter = *link;
+        if (waiter->uaddr != uaddr) {
+            link = &waiter->next;
+            continue;
+        }
+        *link = waiter->next;
+        xSemaphoreGiveFromISR(waiter->sem, &yield);
+        woken++;
+    }
+    portEXIT_CRITICAL(&futex_lock);
+
+    if (task_woken) {
+        *task_woken = yield;
+    } else if (yield) {
+        taskYIELD();
+    }
+    return woken;
+}
+
+/* Unlink a waiter that was not woken up, returns false if esp_futex_wake() or esp_futex_unlock_pi() already did */
+static IRAM_ATTR bool futex_unlink(esp_futex_waiter_t *waiter)
+{
+    esp_futex_waiter_t **link;
+
+    for (link = futex_bucket(waiter->uaddr); *link; link = &(*link)->next) {
+        if (*link == waiter) {
+            *link = waiter->next;
+            return true;
+        }
+    }
+    return false;
+}
+
+static IRAM_ATTR bool futex_has_waiters(volatile uint32_t *uaddr)
+{
+    for (esp_futex_waiter_t *waiter = *futex_bucket(uaddr); waiter; waiter = waiter->next) {
+        if (waiter->uaddr == uaddr) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Recompute the priority of the holder of a mutex futex once one of its waiters timed out, from the
+ * remaining waiters, as FreeRTOS does for its mutexes. Must be called with futex_lock held.
+ */
+static IRAM_ATTR void futex_disinherit_after_timeout(volatile uint32_t *uaddr)
+{
+    esp_map_handle_t *holder = esp_map_verify_from_isr(*uaddr & ~ESP_FUTEX_WAITERS, ESP_MAP_TASK_ID);
+    if (!holder) {
+        return;
+    }
+    TaskHandle_t task = (TaskHandle_t)holder->handle;
+#if !CONFIG_FREERTOS_UNICORE
+    /* The holder could run on the other CPU and update its mutex count concurrently, keep it boosted until it unlocks */
+    if (xTaskGetAffinity(task) != xPortGetCoreID()) {
+        return;
+    }
+#endif
+    UBaseType_t highest = tskIDLE_PRIORITY;
+    for (esp_futex_waiter_t *waiter = *futex_bucket(uaddr); waiter; waiter = waiter->next) {
+        if (waiter->uaddr == uaddr && uxTaskPriorityGet(waiter->task) > highest) {
+            highest = uxTaskPriorityGet(waiter->task);
+        }
+    }
+    /*
+     * FreeRTOS asserts that the holder holds a mutex and only lowers its priority if this is the only one,
+     * but does not count the futex, so count it for the duration of the call (uxDummy12[1] is uxMutexesHeld).
+     * The holder does not run meanwhile, as it can only run on this CPU, which is in a critical section.
+     */
+    ((StaticTask_t *)task)->uxDummy12[1]++;
+    vTaskPriorityDisinheritAfterTimeout(task, highest);
+    ((StaticTask_t *)task)->uxDummy12[1]--;
+}
+
+IRAM_ATTR int esp_futex_lock_pi(volatile uint32_t *uaddr, uint32_t owner, TickType_t timeout)
+{
+    esp_futex_waiter_t waiter = {
+        .uaddr = uaddr,
+        .task = xTaskGetCurrentTaskHandle(),
+    };
+    esp_futex_waiter_t **link;
+    TickType_t start = xTaskGetTickCount();
+    TickType_t remaining = timeout;
+
+    waiter.sem = xSemaphoreCreateBinaryStatic(&waiter.sem_buffer);
+
+    while (1) {
+        portENTER_CRITICAL(&futex_lock);
+        uint32_t val = *uaddr;
+        if ((val & ~ESP_FUTEX_WAITERS) == 0) {
+            /* The mutex is free, take it. The tasks still blocked on it keep ESP_FUTEX_WAITERS set */
+            uint32_t new_val = owner | (futex_has_waiters(uaddr) ? ESP_FUTEX_WAITERS : 0);
+            bool taken = __atomic_compare_exchange_n(uaddr, &val, new_val, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+            portEXIT_CRITICAL(&futex_lock);
+            if (taken) {
+                return 0;
+            }
+            /* Taken by user app meanwhile */
+            continue;
+        }
+        if (timeout != portMAX_DELAY) {
+            TickType_t elapsed = xTaskGetTickCount() - start;
+            remaining = (elapsed < timeout) ? timeout - elapsed : 0;
+        }
+        if (remaining == 0) {
+            portEXIT_CRITICAL(&futex_lock);
+            return -1;
+        }
+        if (!(val & ESP_FUTEX_WAITERS) &&
+                !__atomic_compare_exchange_n(uaddr, &val, val | ESP_FUTEX_WAITERS, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            /* Released or taken over by user app meanwhile */
+            portEXIT_CRITICAL(&futex_lock);
+            continue;
+        }
+        /* The futex word is in user app memory, the holder is only trusted once verified */
+        esp_map_handle_t *holder = esp_map_verify_from_isr(val & ~ESP_FUTEX_WAITERS, ESP_MAP_TASK_ID);
+        if (holder) {
+            xTaskPriorityInherit((TaskHandle_t)holder->handle);
+        }
+        waiter.next = NULL;
+        for (link = futex_bucket(uaddr); *link; link = &(*link)->next) {
+        }
+        *link = &waiter;
+        portEXIT_CRITICAL(&futex_lock);
+
+        if (xSemaphoreTake(waiter.sem, remaining) == pdTRUE) {
+            continue;
+        }
+        portENTER_CRITICAL(&futex_lock);
+        if (futex_unlink(&waiter)) {
+            /* Give back the priority lent to the holder */
+            futex_disinherit_after_timeout(uaddr);
+        } else {
+            /* Woken up while timing out, consume the wake up and try once more */
+            xSemaphoreTake(waiter.sem, 0);
+        }
+        portEXIT_CRITICAL(&futex_lock);
+    }
+}
+
+IRAM_ATTR int esp_futex_unlock_pi(volatile uint32_t *uaddr, uint32_t owner)
+{
+    esp_futex_waiter_t *next = NULL;
+    BaseType_t task_woken = pdFALSE;
+
+    portENTER_CRITICAL(&futex_lock);
+    if ((*uaddr & ~ESP_FUTEX_WAITERS) != owner) {
+        portEXIT_CRITICAL(&futex_lock);
+        return -1;
+    }
+    /* Hand the mutex over to the highest priority waiter, as FreeRTOS does */
+    for (esp_futex_waiter_t *waiter = *futex_bucket(uaddr); waiter; waiter = waiter->next) {
+        if (waiter->uaddr == uaddr &&
+                (next == NULL || uxTaskPriorityGet(waiter->task) > uxTaskPriorityGet(next->task))) {
+            next = waiter;
+        }
+    }
+    if (next) {
+        futex_unlink(next);
+        xSemaphoreGiveFromISR(next->sem, &task_woken);
+    }
+    __atomic_store_n(uaddr, futex_has_waiters(uaddr) ? ESP_FUTEX_WAITERS : 0, __ATOMIC_RELEASE);
+    portEXIT_CRITICAL(&futex_lock);
+
+    /* FreeRTOS only drops an inherited priority once no mutex is held, so account for this one first */
+    if (xTaskPriorityDisinherit(pvTaskIncrementMutexHeldCount()) == pdTRUE) {
+        task_woken = pdTRUE;
+    }
+    if (task_woken) {
+        taskYIELD();
+    }
+    return 0;
+}
+
+void esp_futex_task_deleted(TaskHandle_t task)
+{
+    portENTER_CRITICAL(&futex_lock);
+    for (int i = 0; i < FUTEX_HASH_BUCKETS; i++) {
+        esp_futex_waiter_t **link = &futex_buckets[i];
+        while (*link) {
+            if ((*link)->task == task) {
+                *link = (*link)->next;
+            } else {
+                link = &(*link)->next;
+            }
+        }
+    }
+    portEXIT_CRITICAL(&futex_lock);
+}
@@ -0,0 +1,69 @@
+// Copyright 2020-2022 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//         http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <esp_attr.h>
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include "soc_defs.h"
+#include "esp_kernel_stack_pool.h"
+
+/*
+ * With CONFIG_ESP_SYSCALL_KERNEL_STACK_POOL, the kernel stack TLS pointer of a user task is
+ * only set while the task executes a system call. The system call handler pops a stack from
+ * esp_kernel_stack_pool on entry and pushes it back when returning to user space, both with
+ * interrupts disabled. Free stacks are linked through their lowest word, which is restored to
+ * the fill pattern when the stack is taken, so that stack overflow checks keep working.
+ *
+ * Allocating a stack may take the heap lock, so it is never done with interrupts disabled.
+ * Once interrupts are enabled, a system call which leaves fewer than
+ * CONFIG_ESP_SYSCALL_KERNEL_STACK_POOL_SPARE free stacks refills the pool from the context of
+ * the calling task, before executing the system call. A system call which finds the pool empty
+ * fails right away with -1, using the reserve stack as its kernel stack. Interrupts stay disabled
+ * until it returns, so the reserve stack is never used by two tasks at once.
+ */
+
+DRAM_ATTR void *esp_kernel_stack_pool;
+DRAM_ATTR uint32_t esp_kernel_stack_pool_count;     // Number of stacks in esp_kernel_stack_pool
+DRAM_ATTR StackType_t esp_kernel_stack_pool_reserve[KERNEL_STACK_SIZE / sizeof(StackType_t)] __attribute__((aligned(16)));
+
+static const char *TAG = "kernel_stack_pool";
+static portMUX_TYPE pool_lock = portMUX_INITIALIZER_UNLOCKED;
+
+void esp_kernel_stack_pool_refill(void)
+{
+    while (esp_kernel_stack_pool_count < CONFIG_ESP_SYSCALL_KERNEL_STACK_POOL_SPARE) {
+        void *stack = heap_caps_malloc(KERNEL_STACK_SIZE, portStackMemoryCaps);
+        if (stack == NULL) {
+            ESP_LOGE(TAG, "Insufficient memory for kernel stack");
+            return;
+        }
+        memset(stack, tskSTACK_FILL_BYTE, KERNEL_STACK_SIZE);
+        esp_kernel_stack_pool_put(stack);
+    }
+}
+
+void esp_kernel_stack_pool_put(void *stack)
+{
+    if (stack == NULL || stack == esp_kernel_stack_pool_reserve) {
+        return;
+    }
+    /* The handler accesses the pool with interrupts disabled, keep it from running meanwhile */
+    portENTER_CRITICAL(&pool_lock);
+    *(void **)stack = esp_kernel_stack_pool;
+    esp_kernel_stack_pool = stack;
+    esp_kernel_stack_pool_count++;
+    portEXIT_CRITICAL(&pool_lock);
+}
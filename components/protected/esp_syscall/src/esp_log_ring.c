@@ -0,0 +1,237 @@
+// Copyright 2020-2022 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//         http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <sys/param.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <esp_attr.h>
+#include <esp_log.h>
+#include <esp_freertos_hooks.h>
+#include "soc_defs.h"
+#include "esp_log_ring.h"
+
+#ifdef CONFIG_IDF_TARGET_ESP32C3
+#include "esp32c3/rom/ets_sys.h"
+#elif CONFIG_IDF_TARGET_ESP32S3
+#include "esp32s3/rom/ets_sys.h"
+#endif
+
+#define ESP_LOG_RING_MASK       (ESP_LOG_RING_SIZE - 1)
+#define LOG_RING_TASK_STACK     3072
+#define LOG_RING_TASK_PRIO      (tskIDLE_PRIORITY + 1)
+
+_Static_assert((ESP_LOG_RING_SIZE & ESP_LOG_RING_MASK) == 0, "CONFIG_ESP_SYSCALL_LOG_RING_SIZE must be a power of 2");
+
+static const char *TAG = "esp_log_ring";
+
+/*
+ * esp_log_ring lets user tasks print without waiting for the console. They append their
+ * lines to a ring in user app memory and a protected task writes them to the console.
+ * The tick hook wakes the drainer task up when the ring is not empty, so user app never
+ * needs a system call to hand a line over.
+ *
+ * The ring is in user app memory, so user app may modify it while it is drained.
+ * The indices are only used masked and every record is copied to the drainer stack
+ * before it is written, so this cannot make protected app access memory outside the ring.
+ * A corrupted ring is reset to empty.
+ *
+ * Records are consumed in order, so a task deleted while it appends a record stalls the
+ * ring until user app is restarted, and the following records are dropped.
+ */
+
+static DRAM_ATTR esp_log_ring_t *log_ring;      // Ring registered by user app, NULL if none
+static TaskHandle_t log_ring_task;
+static SemaphoreHandle_t log_ring_mutex;        // Serializes the drainer task and flushes
+static uint32_t log_ring_dropped;               // Dropped bytes already reported
+
+static void esp_log_ring_copy(const esp_log_ring_t *ring, uint32_t pos, void *dst, size_t len)
+{
+    uint32_t offset = pos & ESP_LOG_RING_MASK;
+    size_t first = MIN(len, ESP_LOG_RING_SIZE - offset);
+
+    memcpy(dst, &ring->buf[offset], first);
+    memcpy((uint8_t *)dst + first, &ring->buf[0], len - first);
+}
+
+static void esp_log_ring_clear(esp_log_ring_t *ring, uint32_t pos, size_t len)
+{
+    uint32_t offset = pos & ESP_LOG_RING_MASK;
+    size_t first = MIN(len, ESP_LOG_RING_SIZE - offset);
+
+    memset(&ring->buf[offset], 0, first);
+    memset(&ring->buf[0], 0, len - first);
+}
+
+/* Drop all the records up to tail */
+static void esp_log_ring_reset(esp_log_ring_t *ring, uint32_t tail)
+{
+    memset(ring->buf, 0, ESP_LOG_RING_SIZE);
+    __atomic_store_n(&ring->head, tail, __ATOMIC_RELEASE);
+}
+
+static void esp_log_ring_write(const char *buf, size_t len, bool panic)
+{
+    if (panic) {
+        /* Binary log records may contain NULL characters */
+        for (size_t i = 0; i < len; i++) {
+            ets_printf("%c", buf[i]);
+        }
+    } else {
+        fwrite(buf, len, 1, stdout);
+    }
+}
+
+static void esp_log_ring_drain(esp_log_ring_t *ring, bool panic)
+{
+    char buf[64];
+    uint32_t head = ring->head;
+
+    while (1) {
+        uint32_t tail = ring->tail;
+        if (tail == head) {
+            break;
+        }
+        if (tail - head > ESP_LOG_RING_SIZE || ((head | tail) & 3)) {
+            ESP_EARLY_LOGE(TAG, "Log ring %p has corrupted indices", ring);
+            esp_log_ring_reset(ring, tail);
+            break;
+        }
+        uint32_t *header = (uint32_t *)&ring->buf[head & ESP_LOG_RING_MASK];
+        uint32_t hdr = __atomic_load_n(header, __ATOMIC_ACQUIRE);
+        if (!(hdr & ESP_LOG_RING_RECORD_READY)) {
+            /* The task that reserved this record is still copying it */
+            break;
+        }
+        uint32_t len = hdr & ~ESP_LOG_RING_RECORD_READY;
+        if (len > ESP_LOG_RING_SIZE || ESP_LOG_RING_RECORD_SIZE(len) > tail - head) {
+            ESP_EARLY_LOGE(TAG, "Log ring %p has a corrupted record", ring);
+            esp_log_ring_reset(ring, tail);
+            break;
+        }
+        for (uint32_t offset = 0; offset < len; offset += sizeof(buf)) {
+            size_t chunk = MIN(len - offset, sizeof(buf));
+            esp_log_ring_copy(ring, head + sizeof(uint32_t) + offset, buf, chunk);
+            esp_log_ring_write(buf, chunk, panic);
+        }
+        /* Clear the record, so that none of its bytes is seen as a ready header once the ring wraps around */
+        esp_log_ring_clear(ring, head, ESP_LOG_RING_RECORD_SIZE(len));
+        head += ESP_LOG_RING_RECORD_SIZE(len);
+        __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+    }
+
+    uint32_t dropped = ring->dropped;
+    if (dropped != log_ring_dropped) {
+        int len = snprintf(buf, sizeof(buf), "\n[%u bytes of user app log dropped]\n", dropped - log_ring_dropped);
+        esp_log_ring_write(buf, len, panic);
+        log_ring_dropped = dropped;
+    }
+}
+
+static void esp_log_ring_task(void *arg)
+{
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        xSemaphoreTake(log_ring_mutex, portMAX_DELAY);
+        if (log_ring) {
+            esp_log_ring_drain(log_ring, false);
+        }
+        xSemaphoreGive(log_ring_mutex);
+    }
+}
+
+static IRAM_ATTR void esp_log_ring_tick_hook(void)
+{
+    esp_log_ring_t *ring = log_ring;
+    if (ring && ring->tail != ring->head) {
+        vTaskNotifyGiveFromISR(log_ring_task, NULL);
+    }
+}
+
+esp_err_t esp_log_ring_register(esp_log_ring_t *ring)
+{
+    if (!is_valid_udram_addr(ring) || !is_valid_udram_addr((void *)((int)ring + sizeof(esp_log_ring_t))) ||
+            ((int)ring & (sizeof(uint32_t) - 1))) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (log_ring) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    /* The drainer task is kept across user app restarts */
+    if (log_ring_task == NULL) {
+        log_ring_mutex = xSemaphoreCreateMutex();
+        if (log_ring_mutex == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+        if (xTaskCreate(esp_log_ring_task, "log_ring", LOG_RING_TASK_STACK, NULL, LOG_RING_TASK_PRIO, &log_ring_task) != pdPASS) {
+            vSemaphoreDelete(log_ring_mutex);
+            log_ring_mutex = NULL;
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    if (esp_register_freertos_tick_hook_for_cpu(esp_log_ring_tick_hook, 0) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register tick hook");
+        return ESP_ERR_NO_MEM;
+    }
+
+    memset(ring, 0, sizeof(esp_log_ring_t));
+    log_ring_dropped = 0;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    log_ring = ring;
+    return ESP_OK;
+}
+
+esp_err_t esp_log_ring_flush(void)
+{
+    esp_err_t err = ESP_OK;
+
+    if (log_ring_mutex == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(log_ring_mutex, portMAX_DELAY);
+    if (log_ring) {
+        esp_log_ring_drain(log_ring, false);
+        fflush(stdout);
+    } else {
+        err = ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreGive(log_ring_mutex);
+    return err;
+}
+
+void esp_log_ring_panic_flush(void)
+{
+    esp_log_ring_t *ring = log_ring;
+    if (ring) {
+        esp_log_ring_drain(ring, true);
+    }
+}
+
+void esp_log_ring_unregister(void)
+{
+    esp_deregister_freertos_tick_hook_for_cpu(esp_log_ring_tick_hook, 0);
+    if (log_ring_mutex == NULL) {
+        return;
+    }
+    xSemaphoreTake(log_ring_mutex, portMAX_DELAY);
+    if (log_ring) {
+        esp_log_ring_drain(log_ring, false);
+        log_ring = NULL;
+    }
+    xSemaphoreGive(log_ring_mutex);
+}
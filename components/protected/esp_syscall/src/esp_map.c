@@ -13,201 +13,840 @@
 // limitations under the License.
 
 #include <stdio.h>
+#include <stdbool.h>
 #include <string.h>
+#include <sys/param.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/semphr.h>
 
+#include <esp_attr.h>
 #include <esp_log.h>
 #include <esp_map.h>
 #include <soc_defs.h>
+#include "syscall_structs.h"
 
-#ifdef ESP_MAP_ENABLE_CRC
-#ifdef CONFIG_IDF_TARGET_ESP32C3
-#include "esp32c3/rom/crc.h"
-#endif
+#if CONFIG_ESP_SYSCALL_MAP_STATS
+#include "hal/cpu_hal.h"
 #endif
 
 #define TICKS_TO_WAIT       portMAX_DELAY // Ticks to wait for acquiring the mutex
-#define INIT_HANDLES        64  // Number of esp_map handles supported by default
-#define SIZE_OF_HANDLE (sizeof(intptr_t))
+#define INIT_PAGES          1   // Number of esp_map pages allocated by default
+#define INIT_DIR_SIZE       4   // Number of page pointers the page directory can hold by default
 
-#ifdef ESP_MAP_ENABLE_CRC
-#define WRAP_HANDLE_SIZE (sizeof(esp_map_handle_t) - sizeof(uint16_t))
-#endif
+#define ESP_MAP_PAGE_SHIFT  6
+#define ESP_MAP_PAGE_SIZE   (1 << ESP_MAP_PAGE_SHIFT)   // Number of handle wrappers in a page
+#define ESP_MAP_PAGE_MASK   (ESP_MAP_PAGE_SIZE - 1)
+#define ESP_MAP_MAX_PAGES   (ESP_MAP_MAX_HANDLES / ESP_MAP_PAGE_SIZE)
+#define ESP_MAP_PAGE_WORDS  ((ESP_MAP_MAX_PAGES + 31) / 32)     // Size of a page bitmap, in words
+
+#define ESP_MAP_GET_PAGE(pages, slot)           ((pages)[(slot) >> ESP_MAP_PAGE_SHIFT])
+#define ESP_MAP_GET_ENTRY(pages, slot)          (&ESP_MAP_GET_PAGE(pages, slot)->entries[(slot) & ESP_MAP_PAGE_MASK])
+#define ESP_MAP_GET_SHIM_HANDLE(pages, slot)    (&ESP_MAP_GET_ENTRY(pages, slot)->wrapper)
+
+/*
+ * A free wrapper has the id ESP_MAP_FREE_ID and its gen member holds the generation the
+ * slot will have when it is allocated next. Free entries of a page are linked through
+ * their next member.
+ */
+#define ESP_MAP_FREE_ID                 0
+#define ESP_MAP_LIST_END                0xFFFF
 
-#define ESP_MAP_GET_SHIM_HANDLE(x) ((esp_map_handle_t *)allocated_handles[(x) - ESP_MAP_INDEX_OFFSET])
+/* Live entries of each core type are linked in a list of their own, other types share the last list */
+#define ESP_MAP_FIRST_TYPE_ID           ESP_MAP_QUEUE_ID
+#define ESP_MAP_LAST_TYPE_ID            ESP_MAP_GPIO_ID
+#define ESP_MAP_TYPE_LISTS              (ESP_MAP_LAST_TYPE_ID - ESP_MAP_FIRST_TYPE_ID + 2)
+
+/*
+ * Reverse index is an open addressing hash table with linear probing, keyed by the
+ * protected handle. A bucket holds the slot number plus one, 0 marks an empty bucket.
+ * The table always has at least twice as many buckets as there are slots, so it is
+ * never more than half full.
+ */
+#define ESP_MAP_HASH_EMPTY              0
+#define ESP_MAP_HASH_MIN_BITS           7
+
+/* Bits of a user handle which are never set in a valid handle */
+#define ESP_MAP_INDEX_INVALID_BITS      (~((ESP_MAP_GEN_MASK << ESP_MAP_GEN_SHIFT) | ESP_MAP_INDEX_MASK))
+
+_Static_assert(ESP_MAP_MAX_HANDLES % ESP_MAP_PAGE_SIZE == 0, "esp_map page size must divide the maximum number of handles");
+_Static_assert(ESP_MAP_MAX_HANDLES < ESP_MAP_LIST_END, "esp_map slot does not fit in the list links");
+_Static_assert(ESP_MAP_STATS_TYPES == ESP_MAP_TYPE_LISTS, "esp_map statistics do not match the type lists");
+
+/* Entry of an esp_map page, the wrapper is its first member so both share the same address */
+typedef struct {
+    esp_map_handle_t wrapper;
+    uint16_t prev;  // Previous entry in the list of its type
+    uint16_t next;  // Next entry in the list of its type, or in the free list
+} esp_map_entry_t;
+
+/* Page of esp_map, entries come first so an entry is found with a single offset */
+typedef struct {
+    esp_map_entry_t entries[ESP_MAP_PAGE_SIZE];
+    uint16_t free_head;     // First free slot of the page, ESP_MAP_LIST_END if the page is full
+    uint16_t free_count;    // Number of free slots in the page
+} esp_map_page_t;
 
 static const char *TAG = "esp_map";
 
 /*
- * esp_map is a two layered structure used to maintain user app resources allocated
- * on protected app side. First layer uses esp_map_handle_t structure, which holds
- * type of the resource and actual pointer to protected app resource. CRC verification
- * can be enabled for additional security. Second layer is a dynamically allocated
- * array holding pointer to esp_map_handle_t. Protected app does not return kernel
- * DRAM pointer to user app and instead return the index of esp_map_handle_t structure
- * stored in the array. esp_map can also be implemented as a single layered structure
- * by allocating array of the type esp_map_handle_t. However, this will add into the
- * complexity of searching for free slots in the array. Hence, it is broken into two
- * layers. esp_map layer uses a mutex for thread safety and this layer cannot be used
- * from an ISR or a critical section.
+ * esp_map is a structure used to maintain user app resources allocated on protected
+ * app side. Each resource is described by an esp_map_handle_t structure, which holds
+ * type of the resource, actual pointer to protected app resource and the generation
+ * of the slot it is stored in. Protected app does not return kernel DRAM pointer to
+ * user app and instead return the slot number of the esp_map_handle_t structure,
+ * tagged with the generation of the slot (see esp_map.h). The generation is bumped
+ * whenever a slot is released, so a stale index held by user app is rejected by a
+ * single compare once the slot has been released.
+ *
+ * The esp_map_handle_t structures are not allocated individually. They are stored in
+ * fixed size pages of ESP_MAP_PAGE_SIZE entries, and the slot number selects the page
+ * from a page directory and the entry within the page. When all the slots are in use,
+ * esp_map grows by one page. Pages are never moved, so a wrapper returned by esp_map
+ * stays at the same address until it is removed, and the protected heap is not fragmented
+ * by handle churn. Unused entries of a page are linked into the free list of the page, and
+ * a handle is always added to the lowest page with a free slot, so that the pages at the
+ * end of the directory drain once a burst of handles is released. An empty page is freed
+ * when less than half of the remaining slots would be in use, which leaves enough room
+ * for the map not to grow back right away. A freed page leaves a hole in the directory,
+ * and the indices of the handles in the other pages stay valid. Live entries are linked
+ * into a list per type, so that all the resources of a type can be visited without
+ * walking the free slots (see esp_map_for_each_type).
+ *
+ * esp_map also keeps a reverse index from the protected handle to its slot, so that
+ * the user handle of a protected resource can be found without walking all the slots
+ * (see esp_map_lookup_by_ptr). Handles added with a NULL pointer are not indexed.
+ *
+ * Adding, removing and growing esp_map are serialized by a recursive mutex, so these APIs
+ * cannot be used from an ISR or a critical section. Lookups (esp_map_verify and
+ * esp_map_get_handle) take no lock, and esp_map_verify_from_isr can be used from an ISR
+ * or a critical section. Every modification of esp_map is published
+ * inside a short sequence window: the writer makes map_seq odd, updates the entries
+ * and makes map_seq even again. A reader samples map_seq, reads the entry and retries
+ * if map_seq changed in the meantime. The window is held inside a critical section so
+ * that a reader, including an ISR, can never preempt a writer in the middle of it. A
+ * reader on the other core only spins for the few instructions of the window.
+ *
+ * A page directory replaced by a bigger one, a replaced reverse index and a freed page are
+ * unlinked inside the window, but a reader may have loaded their address just before and
+ * still be reading them. Lookups run with interrupts disabled, so they cannot be preempted
+ * or moved to another core, and each lookup makes the counter of its CPU odd while it runs.
+ * Before returning an unlinked block to the heap, the writer waits for every CPU found in a
+ * lookup to leave it (see _esp_map_synchronize). A lookup which starts after the window can
+ * only find the new pointers, so once this wait is over no reader can hold the old block.
+ * The directory itself never shrinks, it only holds one pointer per page.
+ *
+ * A wrapper returned by a lookup stays in place until its handle is removed. Its page is
+ * only freed once all of its handles have been removed, so a caller which keeps using a
+ * wrapper must not race with the removal of that handle, as it would race with the
+ * deletion of the resource the handle wraps anyway.
  *
  * The following usecase demonstrates esp_map implementation:
  *
  * |-------------------------------------------------------------|
  * | Actual Resource |    esp_map_handle_t    |     Map Index    |
  * |-------------------------------------------------------------|
- * |    Semaphore    | id = ESP_MAP_QUEUE_ID  |   0x3FCC6000     |
+ * |    Semaphore    | id = ESP_MAP_QUEUE_ID  |   Page 0, Slot 0 |
  * |                 | handle = 0x3FC96100    |                  |
- * |   (0x3FC96100)  |    (0x3FCC6000)        |      (1024)      |
+ * |   (0x3FC96100)  |    gen = 0             |      (1024)      |
  * |-------------------------------------------------------------|
- * |      Task       | id = ESP_MAP_TASK_ID   |    0x3FCC6004    |
+ * |      Task       | id = ESP_MAP_TASK_ID   |   Page 0, Slot 1 |
  * |                 | handle = 0x3FC96104    |                  |
- * |   (0x3FC96104)  |    (0x3FCC6004)        |     (1025)       |
+ * |   (0x3FC96104)  |    gen = 0             |     (1025)       |
  * |-------------------------------------------------------------|
- * |     xTimer      | id = ESP_MAP_XTIMER_ID |    0x3FCC6008    |
- * |                 | handle = 0x3FC96104    |                  |
- * |   (0x3FC96104)  |    (0x3FCC6008)        |     (1026)       |
+ * |     xTimer      | id = ESP_MAP_XTIMER_ID |   Page 0, Slot 2 |
+ * |                 | handle = 0x3FC96108    |                  |
+ * |   (0x3FC96108)  |    gen = 1             |     (66562)      |
  * |-------------------------------------------------------------|
  */
 
-static DRAM_ATTR intptr_t *allocated_handles;   // Array of handles created by esp_map layer
-static DRAM_ATTR int allocated_handle_size;     // Size of currently allocated array
-static DRAM_ATTR SemaphoreHandle_t map_lock;    // Mutex for adding thread safety in esp_map layer
+static DRAM_ATTR esp_map_page_t **map_pages;    // Page directory, array of pointers to the pages, NULL for a freed page
+static DRAM_ATTR int map_dir_size;              // Number of page pointers the page directory can hold
+static DRAM_ATTR int map_slot_limit;            // Slots up to the end of the last allocated page, valid slots are below it
+static DRAM_ATTR int allocated_handle_size;     // Number of slots in the allocated pages
+static DRAM_ATTR int used_handle_count;         // Number of slots in use
+static DRAM_ATTR uint16_t map_next_page_gen;    // Generation of the slots of the next allocated page
+static DRAM_ATTR uint32_t map_free_pages[ESP_MAP_PAGE_WORDS];  // Bitmap of the pages with a free slot
+static DRAM_ATTR uint32_t map_empty_pages[ESP_MAP_PAGE_WORDS]; // Bitmap of the pages with no slot in use
+static DRAM_ATTR uint16_t map_type_head[ESP_MAP_TYPE_LISTS];    // First entry of the list of each type
+static DRAM_ATTR uint16_t *map_hash;            // Reverse index, protected handle to slot
+static DRAM_ATTR uint32_t map_hash_bits;        // Reverse index holds (1 << map_hash_bits) buckets
+static DRAM_ATTR SemaphoreHandle_t map_lock;    // Mutex for serializing writers of esp_map layer
+static DRAM_ATTR uint32_t map_seq;              // Sequence counter, odd while a writer updates esp_map
+static DRAM_ATTR portMUX_TYPE map_spinlock = portMUX_INITIALIZER_UNLOCKED;
+static DRAM_ATTR uint32_t map_reader_seq[portNUM_PROCESSORS];  // Counter of each CPU, odd while a lookup runs on it
+
+#if CONFIG_ESP_SYSCALL_MAP_STATS
+/*
+ * Counters updated by writers are protected by map_lock. Verify counters are updated by
+ * lock-free readers without atomics, so they are best effort and may miss an update.
+ */
+static DRAM_ATTR esp_map_stats_t map_stats;
+#define ESP_MAP_STAT_INC(x)     (map_stats.x++)
+#else
+#define ESP_MAP_STAT_INC(x)
+#endif
+
+static inline BaseType_t _esp_map_lock(void)
+{
+#if CONFIG_ESP_SYSCALL_MAP_STATS
+    uint32_t start = cpu_hal_get_cycle_count();
+    BaseType_t ret = xSemaphoreTakeRecursive(map_lock, TICKS_TO_WAIT);
+    uint32_t wait_cycles = cpu_hal_get_cycle_count() - start;
+    if (ret == pdPASS) {
+        map_stats.lock_acquisitions++;
+        map_stats.lock_wait_cycles += wait_cycles;
+        map_stats.lock_max_wait_cycles = MAX(map_stats.lock_max_wait_cycles, wait_cycles);
+    }
+    return ret;
+#else
+    return xSemaphoreTakeRecursive(map_lock, TICKS_TO_WAIT);
+#endif
+}
+
+static inline void _esp_map_unlock(void)
+{
+    xSemaphoreGiveRecursive(map_lock);
+}
+
+static inline void _esp_map_write_begin(void)
+{
+    portENTER_CRITICAL(&map_spinlock);
+    __atomic_store_n(&map_seq, map_seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void _esp_map_write_end(void)
+{
+    __atomic_store_n(&map_seq, map_seq + 1, __ATOMIC_RELEASE);
+    portEXIT_CRITICAL(&map_spinlock);
+}
+
+FORCE_INLINE_ATTR uint32_t _esp_map_read_begin(void)
+{
+    uint32_t seq;
+    /* A writer on the other core is inside its window, it is only a few instructions long */
+    while ((seq = __atomic_load_n(&map_seq, __ATOMIC_ACQUIRE)) & 1) {
+    }
+    return seq;
+}
+
+FORCE_INLINE_ATTR bool _esp_map_read_retry(uint32_t seq)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&map_seq, __ATOMIC_RELAXED) != seq;
+}
+
+/*
+ * Mark a lookup on this CPU. Interrupts stay disabled until _esp_map_reader_exit so that
+ * the lookup is neither preempted nor moved to another core, and it only takes a few
+ * instructions. An ISR cannot interleave with the increment, as interrupts are disabled.
+ */
+FORCE_INLINE_ATTR UBaseType_t _esp_map_reader_enter(void)
+{
+    UBaseType_t state = portSET_INTERRUPT_MASK_FROM_ISR();
+    uint32_t *reader_seq = &map_reader_seq[xPortGetCoreID()];
+    __atomic_store_n(reader_seq, *reader_seq + 1, __ATOMIC_RELAXED);
+    /* Writer must see the counter odd before this lookup loads any pointer */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return state;
+}
+
+FORCE_INLINE_ATTR void _esp_map_reader_exit(UBaseType_t state)
+{
+    uint32_t *reader_seq = &map_reader_seq[xPortGetCoreID()];
+    __atomic_store_n(reader_seq, *reader_seq + 1, __ATOMIC_RELEASE);
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(state);
+}
+
+/*
+ * Wait until no lookup started before the last window is still running, so that a block
+ * unlinked in that window can be freed. A lookup cannot be preempted, so the counter of
+ * the CPU running the writer is always even, and the others stay odd only for a few instructions.
+ * Must be called with map_lock held, outside the sequence window.
+ */
+static void _esp_map_synchronize(void)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (int i = 0; i < portNUM_PROCESSORS; i++) {
+        uint32_t seq = __atomic_load_n(&map_reader_seq[i], __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            while (__atomic_load_n(&map_reader_seq[i], __ATOMIC_ACQUIRE) == seq) {
+            }
+        }
+    }
+}
+
+/*
+ * Read the wrapper stored at wrapper_index without taking a lock. If type is non-zero,
+ * the type identifier of the wrapper must match it as well. It is forcibly inlined so
+ * that esp_map_verify_from_isr does not depend on code placed in flash.
+ */
+FORCE_INLINE_ATTR esp_map_handle_t *_esp_map_lookup(int wrapper_index, int type)
+{
+    esp_map_handle_t *wrapper_handle;
+    uint32_t seq;
+    UBaseType_t state = _esp_map_reader_enter();
+    do {
+        seq = _esp_map_read_begin();
+        wrapper_handle = NULL;
+        int slot = ESP_MAP_INDEX_TO_SLOT(wrapper_index);
+        if ((wrapper_index & ESP_MAP_INDEX_INVALID_BITS) || slot < 0 || slot >= map_slot_limit) {
+            continue;
+        }
+        esp_map_page_t *page = ESP_MAP_GET_PAGE(map_pages, slot);
+        if (!page) {
+            continue;
+        }
+        esp_map_handle_t *entry = &page->entries[slot & ESP_MAP_PAGE_MASK].wrapper;
+        if (entry->id == ESP_MAP_FREE_ID || entry->gen != ESP_MAP_INDEX_TO_GEN(wrapper_index)) {
+            continue;
+        }
+        if (type && entry->id != type) {
+            continue;
+        }
+        wrapper_handle = entry;
+    } while (_esp_map_read_retry(seq));
+    _esp_map_reader_exit(state);
+    return wrapper_handle;
+}
+
+static inline uint32_t _esp_map_hash(const void *ptr, uint32_t bits)
+{
+    /* Fibonacci hashing, the top bits of the product depend on all the bits of the pointer */
+    return ((uint32_t)(uintptr_t)ptr * 2654435769u) >> (32 - bits);
+}
+
+/* Must be called with map_lock held, and inside the sequence window if the table is published */
+static void _esp_map_hash_insert(uint16_t *hash, uint32_t bits, const void *ptr, int slot)
+{
+    uint32_t mask = (1 << bits) - 1;
+    uint32_t i = _esp_map_hash(ptr, bits);
+    while (hash[i] != ESP_MAP_HASH_EMPTY) {
+        i = (i + 1) & mask;
+    }
+    hash[i] = slot + 1;
+}
+
+/* Must be called with map_lock held and inside the sequence window */
+static void _esp_map_hash_delete(const void *ptr, int slot)
+{
+    uint32_t mask = (1 << map_hash_bits) - 1;
+    uint32_t i = _esp_map_hash(ptr, map_hash_bits);
+    while (map_hash[i] != slot + 1) {
+        if (map_hash[i] == ESP_MAP_HASH_EMPTY) {
+            return;
+        }
+        i = (i + 1) & mask;
+    }
+    /*
+     * Shift the following entries of the probe sequence back into the hole, so that
+     * lookups never need tombstones. An entry moves if its home bucket does not lie
+     * cyclically between the hole and its current bucket.
+     */
+    for (uint32_t j = (i + 1) & mask; map_hash[j] != ESP_MAP_HASH_EMPTY; j = (j + 1) & mask) {
+        const void *key = ESP_MAP_GET_SHIM_HANDLE(map_pages, map_hash[j] - 1)->handle;
+        uint32_t home = _esp_map_hash(key, map_hash_bits);
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            map_hash[i] = map_hash[j];
+            i = j;
+        }
+    }
+    map_hash[i] = ESP_MAP_HASH_EMPTY;
+}
+
+/*
+ * Build a reverse index sized for slot_count slots and publish it. Must be called with
+ * map_lock held, with the allocated pages holding at most slot_count slots.
+ */
+static int _esp_map_hash_resize(int slot_count)
+{
+    uint32_t bits = ESP_MAP_HASH_MIN_BITS;
+    while ((1 << bits) < 2 * slot_count) {
+        bits++;
+    }
+    if (map_hash && bits == map_hash_bits) {
+        return 0;
+    }
+    uint16_t *new_hash = heap_caps_calloc(1 << bits, sizeof(uint16_t), MALLOC_CAP_DEFAULT | MALLOC_CAP_INTERNAL);
+    if (!new_hash) {
+        ESP_LOGE(TAG, "Failed to allocate reverse index");
+        return -1;
+    }
+    for (int slot = 0; slot < map_slot_limit; slot++) {
+        if (!ESP_MAP_GET_PAGE(map_pages, slot)) {
+            slot += ESP_MAP_PAGE_MASK;
+            continue;
+        }
+        esp_map_handle_t *entry = ESP_MAP_GET_SHIM_HANDLE(map_pages, slot);
+        if (entry->id != ESP_MAP_FREE_ID && entry->handle) {
+            _esp_map_hash_insert(new_hash, bits, entry->handle, slot);
+        }
+    }
+
+    uint16_t *old_hash = map_hash;
+    _esp_map_write_begin();
+    map_hash = new_hash;
+    map_hash_bits = bits;
+    _esp_map_write_end();
+
+    if (old_hash) {
+        _esp_map_synchronize();
+        heap_caps_free(old_hash);
+    }
+    return 0;
+}
+
+static inline void _esp_map_page_bit_set(uint32_t *bitmap, int page_index)
+{
+    bitmap[page_index >> 5] |= 1U << (page_index & 31);
+}
+
+static inline void _esp_map_page_bit_clear(uint32_t *bitmap, int page_index)
+{
+    bitmap[page_index >> 5] &= ~(1U << (page_index & 31));
+}
+
+/* Lowest page set in the bitmap, -1 if none */
+static int _esp_map_page_bit_first(const uint32_t *bitmap)
+{
+    int words = (map_slot_limit / ESP_MAP_PAGE_SIZE + 31) / 32;
+    for (int i = 0; i < words; i++) {
+        if (bitmap[i]) {
+            return i * 32 + __builtin_ctz(bitmap[i]);
+        }
+    }
+    return -1;
+}
+
+/* Highest page set in the bitmap, -1 if none */
+static int _esp_map_page_bit_last(const uint32_t *bitmap)
+{
+    int words = (map_slot_limit / ESP_MAP_PAGE_SIZE + 31) / 32;
+    for (int i = words - 1; i >= 0; i--) {
+        if (bitmap[i]) {
+            return i * 32 + 31 - __builtin_clz(bitmap[i]);
+        }
+    }
+    return -1;
+}
+
+/* Link the slots of a new page into its free list in ascending order */
+static void _esp_map_init_page(esp_map_page_t *page, int first_slot)
+{
+    for (int i = 0; i < ESP_MAP_PAGE_SIZE; i++) {
+        page->entries[i].wrapper.id = ESP_MAP_FREE_ID;
+        page->entries[i].wrapper.gen = map_next_page_gen;
+        page->entries[i].wrapper.handle = NULL;
+        page->entries[i].next = first_slot + i + 1;
+    }
+    page->entries[ESP_MAP_PAGE_SIZE - 1].next = ESP_MAP_LIST_END;
+    page->free_head = first_slot;
+    page->free_count = ESP_MAP_PAGE_SIZE;
+}
+
+FORCE_INLINE_ATTR int _esp_map_type_list(int type)
+{
+    if (type >= ESP_MAP_FIRST_TYPE_ID && type <= ESP_MAP_LAST_TYPE_ID) {
+        return type - ESP_MAP_FIRST_TYPE_ID;
+    }
+    return ESP_MAP_TYPE_LISTS - 1;
+}
+
+/* Must be called with map_lock held */
+static void _esp_map_list_insert(int slot, int type)
+{
+    uint16_t *head = &map_type_head[_esp_map_type_list(type)];
+    esp_map_entry_t *entry = ESP_MAP_GET_ENTRY(map_pages, slot);
+    entry->prev = ESP_MAP_LIST_END;
+    entry->next = *head;
+    if (*head != ESP_MAP_LIST_END) {
+        ESP_MAP_GET_ENTRY(map_pages, *head)->prev = slot;
+    }
+    *head = slot;
+}
+
+/* Must be called with map_lock held */
+static void _esp_map_list_unlink(int slot)
+{
+    esp_map_entry_t *entry = ESP_MAP_GET_ENTRY(map_pages, slot);
+    if (entry->prev != ESP_MAP_LIST_END) {
+        ESP_MAP_GET_ENTRY(map_pages, entry->prev)->next = entry->next;
+    } else {
+        map_type_head[_esp_map_type_list(entry->wrapper.id)] = entry->next;
+    }
+    if (entry->next != ESP_MAP_LIST_END) {
+        ESP_MAP_GET_ENTRY(map_pages, entry->next)->prev = entry->prev;
+    }
+}
+
+/*
+ * Add one page to esp_map, up to ESP_MAP_MAX_HANDLES. The page fills the lowest hole
+ * in the page directory, if any. Must be called with map_lock held.
+ * Returns -1 if esp_map cannot grow any further.
+ */
+static int _esp_map_grow(void)
+{
+    int page_count = map_slot_limit / ESP_MAP_PAGE_SIZE;
+    int page_index = 0;
+    while (page_index < page_count && map_pages[page_index]) {
+        page_index++;
+    }
+    if (page_index == ESP_MAP_MAX_PAGES) {
+        ESP_LOGE(TAG, "Maximum number of handles reached");
+        return -1;
+    }
+    esp_map_page_t *page = heap_caps_malloc(sizeof(esp_map_page_t), MALLOC_CAP_DEFAULT | MALLOC_CAP_INTERNAL);
+    if (!page) {
+        ESP_LOGE(TAG, "Failed to allocate page for handles");
+        return -1;
+    }
+    /* Slots of the new page are all free, the current pages are enough to build the index */
+    if (_esp_map_hash_resize(allocated_handle_size + ESP_MAP_PAGE_SIZE) != 0) {
+        heap_caps_free(page);
+        return -1;
+    }
+    _esp_map_init_page(page, page_index * ESP_MAP_PAGE_SIZE);
+
+    esp_map_page_t **old_pages = NULL;
+    esp_map_page_t **new_pages = map_pages;
+    int new_dir_size = map_dir_size;
+    if (page_index == map_dir_size) {
+        /*
+         * The directory cannot be reallocated in place as lock-free readers may still be using it.
+         * Build the new directory aside and publish it, the old one is freed once no lookup uses it.
+         */
+        new_dir_size = MIN(2 * map_dir_size, ESP_MAP_MAX_PAGES);
+        new_pages = heap_caps_calloc(new_dir_size, sizeof(esp_map_page_t *), MALLOC_CAP_DEFAULT | MALLOC_CAP_INTERNAL);
+        if (!new_pages) {
+            ESP_LOGE(TAG, "Failed to allocate page directory");
+            heap_caps_free(page);
+            return -1;
+        }
+        memcpy(new_pages, map_pages, page_count * sizeof(esp_map_page_t *));
+        old_pages = map_pages;
+    }
 
-_Static_assert(sizeof(allocated_handles) == SIZE_OF_HANDLE, "Size of allocated_handles array does not match size of intptr_t.");
+    _esp_map_write_begin();
+    new_pages[page_index] = page;
+    map_pages = new_pages;
+    map_dir_size = new_dir_size;
+    map_slot_limit = MAX(map_slot_limit, (page_index + 1) * ESP_MAP_PAGE_SIZE);
+    _esp_map_write_end();
+    allocated_handle_size += ESP_MAP_PAGE_SIZE;
+    _esp_map_page_bit_set(map_free_pages, page_index);
+    _esp_map_page_bit_set(map_empty_pages, page_index);
+    ESP_MAP_STAT_INC(grows);
+
+    if (old_pages) {
+        _esp_map_synchronize();
+        heap_caps_free(old_pages);
+    }
+    return 0;
+}
+
+/* Free an empty page. Must be called with map_lock held. */
+static void _esp_map_free_page(int page_index)
+{
+    esp_map_page_t *page = map_pages[page_index];
+    /*
+     * Stale indices of the slots of this page carry an older generation than the slots
+     * hold now. Slots of the next allocated page start at the highest generation seen in
+     * a freed page, so that a stale index does not become valid if its page is reused.
+     */
+    for (int i = 0; i < ESP_MAP_PAGE_SIZE; i++) {
+        map_next_page_gen = MAX(map_next_page_gen, page->entries[i].wrapper.gen);
+    }
+    int slot_limit = map_slot_limit;
+    if (slot_limit == (page_index + 1) * ESP_MAP_PAGE_SIZE) {
+        do {
+            slot_limit -= ESP_MAP_PAGE_SIZE;
+        } while (slot_limit && !map_pages[slot_limit / ESP_MAP_PAGE_SIZE - 1]);
+    }
+
+    _esp_map_write_begin();
+    map_pages[page_index] = NULL;
+    map_slot_limit = slot_limit;
+    _esp_map_write_end();
+    allocated_handle_size -= ESP_MAP_PAGE_SIZE;
+    _esp_map_page_bit_clear(map_free_pages, page_index);
+    _esp_map_page_bit_clear(map_empty_pages, page_index);
+    ESP_MAP_STAT_INC(shrinks);
+
+    _esp_map_synchronize();
+    heap_caps_free(page);
+}
+
+/*
+ * Free empty pages while less than half of the remaining slots would be in use. The first
+ * page is always kept. Must be called with map_lock held.
+ */
+static void _esp_map_shrink(void)
+{
+    bool freed = false;
+    while (used_handle_count <= (allocated_handle_size - ESP_MAP_PAGE_SIZE) / 2) {
+        int page_index = _esp_map_page_bit_last(map_empty_pages);
+        if (page_index <= 0) {
+            break;
+        }
+        _esp_map_free_page(page_index);
+        freed = true;
+    }
+    /* Reverse index is only rebuilt once it is four times bigger than needed, failing to shrink it is harmless */
+    if (freed && (8 * allocated_handle_size) <= (1 << map_hash_bits)) {
+        _esp_map_hash_resize(allocated_handle_size);
+    }
+}
 
 void __attribute__((constructor)) esp_map_init(void)
 {
-    map_lock = xSemaphoreCreateMutex();
+    map_lock = xSemaphoreCreateRecursiveMutex();
     if (!map_lock) {
         ESP_EARLY_LOGE(TAG, "Mutex for esp_map could not be created");
     }
-    allocated_handles = (intptr_t *)heap_caps_calloc(1, INIT_HANDLES * SIZE_OF_HANDLE, MALLOC_CAP_DEFAULT | MALLOC_CAP_INTERNAL);
-    if (!allocated_handles) {
+    map_pages = heap_caps_calloc(INIT_DIR_SIZE, sizeof(esp_map_page_t *), MALLOC_CAP_DEFAULT | MALLOC_CAP_INTERNAL);
+    if (!map_pages) {
         ESP_LOGE(TAG, "Failed to allocate array for handles");
         abort();
     }
-    allocated_handle_size = INIT_HANDLES;
+    map_dir_size = INIT_DIR_SIZE;
+    map_slot_limit = 0;
+    allocated_handle_size = 0;
+    memset(map_type_head, 0xFF, sizeof(map_type_head));
+    for (int i = 0; i < INIT_PAGES; i++) {
+        if (_esp_map_grow() != 0) {
+            abort();
+        }
+    }
 }
 
-static inline int _esp_map_get_free_index(void)
+/* Take a free slot from the lowest page which has one. Must be called with map_lock held. */
+static int _esp_map_get_free_index(void)
 {
-    for (int i = 0; i < allocated_handle_size; i++) {
-        if (!allocated_handles[i]) {
-            return i;
+    int page_index = _esp_map_page_bit_first(map_free_pages);
+    if (page_index < 0) {
+        if (_esp_map_grow() != 0) {
+            return -1;
         }
+        page_index = _esp_map_page_bit_first(map_free_pages);
     }
-    return -1;
+    esp_map_page_t *page = map_pages[page_index];
+    int free_index = page->free_head;
+    page->free_head = ESP_MAP_GET_ENTRY(map_pages, free_index)->next;
+    if (--page->free_count == 0) {
+        _esp_map_page_bit_clear(map_free_pages, page_index);
+    }
+    _esp_map_page_bit_clear(map_empty_pages, page_index);
+    return free_index;
+}
+
+/* Return a slot to the free list of its page. Must be called with map_lock held. */
+static void _esp_map_put_free_index(int slot)
+{
+    int page_index = slot >> ESP_MAP_PAGE_SHIFT;
+    esp_map_page_t *page = map_pages[page_index];
+    ESP_MAP_GET_ENTRY(map_pages, slot)->next = page->free_head;
+    page->free_head = slot;
+    if (++page->free_count == ESP_MAP_PAGE_SIZE) {
+        _esp_map_page_bit_set(map_empty_pages, page_index);
+    }
+    _esp_map_page_bit_set(map_free_pages, page_index);
 }
 
-/* Allocate memory for handle wrapper and set its members */
+/* Take a free handle wrapper and set its members */
 int esp_map_add(void *handle, int type)
 {
     /* esp_map APIs should not be called from ISR context. Hence, this assert is added */
     assert(xPortCanYield());
-    esp_map_handle_t *wrapper_handle = heap_caps_malloc(sizeof(esp_map_handle_t), MALLOC_CAP_DEFAULT | MALLOC_CAP_INTERNAL);
-    if (!wrapper_handle) {
+    if (_esp_map_lock() != pdPASS) {
         return 0;
     }
+    int free_index = _esp_map_get_free_index();
+    if (free_index < 0) {
+        _esp_map_unlock();
+        return 0;
+    }
+    esp_map_handle_t *wrapper_handle = ESP_MAP_GET_SHIM_HANDLE(map_pages, free_index);
+    _esp_map_write_begin();
     wrapper_handle->id = type;
     wrapper_handle->handle = handle;
-#ifdef ESP_MAP_ENABLE_CRC
-    wrapper_handle->crc = crc16_le(0, (uint8_t const *)wrapper_handle, WRAP_HANDLE_SIZE);
-#endif
-    if (xSemaphoreTake(map_lock, TICKS_TO_WAIT) != pdPASS) {
-        return 0;
+    if (handle) {
+        _esp_map_hash_insert(map_hash, map_hash_bits, handle, free_index);
     }
-    int free_index = _esp_map_get_free_index();
-    if (free_index == -1) {
-        allocated_handles = heap_caps_realloc(allocated_handles, (2 * allocated_handle_size * SIZE_OF_HANDLE), MALLOC_CAP_DEFAULT | MALLOC_CAP_INTERNAL);
-        if (!allocated_handles) {
-            ESP_LOGE(TAG, "Failed to realloc handle array");
-            abort();
-        }
-        /*
-         * Realloc does not set allocated memory to 0. Initially allocated
-         * memory is set to zero. Hence, call memset from allocated_handle_size
-         * to end of allocated array.
-         */
-        memset(allocated_handles + allocated_handle_size, 0, (allocated_handle_size * SIZE_OF_HANDLE));
-        allocated_handle_size *= 2;
-        free_index = _esp_map_get_free_index();
+    _esp_map_write_end();
+    _esp_map_list_insert(free_index, type);
+    used_handle_count++;
+    ESP_MAP_STAT_INC(adds);
+#if CONFIG_ESP_SYSCALL_MAP_STATS
+    map_stats.peak_handles = MAX(map_stats.peak_handles, used_handle_count);
+#endif
+    int wrapper_index = ESP_MAP_MAKE_INDEX(free_index, wrapper_handle->gen);
+    _esp_map_unlock();
+    return wrapper_index;
+}
+
+FORCE_INLINE_ATTR esp_map_handle_t *_esp_map_verify(int wrapper_index, int type)
+{
+    esp_map_handle_t *wrapper_handle = _esp_map_lookup(wrapper_index, type);
+#if CONFIG_ESP_SYSCALL_MAP_STATS
+    if (wrapper_handle) {
+        map_stats.verify_hits++;
+    } else {
+        map_stats.verify_misses[_esp_map_type_list(type)]++;
     }
-    allocated_handles[free_index] = (intptr_t) wrapper_handle;
-    xSemaphoreGive(map_lock);
-    return (ESP_MAP_INDEX_OFFSET + free_index);
+#endif
+    return wrapper_handle;
 }
 
-/* Verify type identifier and CRC of the handle wrapper */
+/* Verify generation and type identifier of the handle wrapper */
 esp_map_handle_t *esp_map_verify(int wrapper_index, int type)
 {
     /* esp_map APIs should not be called from ISR context. Hence, this assert is added */
     assert(xPortCanYield());
-    if (wrapper_index < ESP_MAP_INDEX_OFFSET || wrapper_index > (ESP_MAP_INDEX_OFFSET + allocated_handle_size)) {
-        return NULL;
-    }
-    if (xSemaphoreTake(map_lock, TICKS_TO_WAIT) != pdPASS) {
-        return NULL;
+    return _esp_map_verify(wrapper_index, type);
+}
+
+IRAM_ATTR esp_map_handle_t *esp_map_verify_from_isr(int wrapper_index, int type)
+{
+    return _esp_map_verify(wrapper_index, type);
+}
+
+esp_map_handle_t *esp_map_get_handle(int wrapper_index)
+{
+    /* esp_map APIs should not be called from ISR context. Hence, this assert is added */
+    assert(xPortCanYield());
+    return _esp_map_lookup(wrapper_index, 0);
+}
+
+void esp_map_remove(int wrapper_index)
+{
+    /* esp_map APIs should not be called from ISR context. Hence, this assert is added */
+    assert(xPortCanYield());
+    if (_esp_map_lock() != pdPASS) {
+        return;
     }
-    esp_map_handle_t *wrapper_handle = ESP_MAP_GET_SHIM_HANDLE(wrapper_index);
-    if (!is_valid_kdram_addr(wrapper_handle)) {
-        goto error;
+    int slot = ESP_MAP_INDEX_TO_SLOT(wrapper_index);
+    if ((wrapper_index & ESP_MAP_INDEX_INVALID_BITS) || slot < 0 || slot >= map_slot_limit ||
+            !ESP_MAP_GET_PAGE(map_pages, slot)) {
+        goto exit;
     }
-    if (wrapper_handle->id != type) {
-        goto error;
+    esp_map_handle_t *wrapper_handle = ESP_MAP_GET_SHIM_HANDLE(map_pages, slot);
+    /*
+     * Skip slots that are already on the free list so a double remove cannot corrupt it,
+     * and stale indexes so that they cannot release a slot which has been reused.
+     */
+    if (wrapper_handle->id == ESP_MAP_FREE_ID || wrapper_handle->gen != ESP_MAP_INDEX_TO_GEN(wrapper_index)) {
+        goto exit;
     }
-#ifdef ESP_MAP_ENABLE_CRC
-    uint16_t crc = crc16_le(0, (uint8_t const *)wrapper_handle, WRAP_HANDLE_SIZE);
-    if (wrapper_handle->crc != crc) {
-        goto error;
+    _esp_map_list_unlink(slot);
+    _esp_map_write_begin();
+    if (wrapper_handle->handle) {
+        _esp_map_hash_delete(wrapper_handle->handle, slot);
     }
-#endif
-    xSemaphoreGive(map_lock);
-    return wrapper_handle;
-error:
-    xSemaphoreGive(map_lock);
-    return NULL;
+    wrapper_handle->id = ESP_MAP_FREE_ID;
+    wrapper_handle->gen = (wrapper_handle->gen + 1) & ESP_MAP_GEN_MASK;
+    _esp_map_write_end();
+    _esp_map_put_free_index(slot);
+    used_handle_count--;
+    ESP_MAP_STAT_INC(removes);
+    _esp_map_shrink();
+exit:
+    _esp_map_unlock();
 }
 
-esp_map_handle_t *esp_map_get_handle(int wrapper_index)
+int esp_map_lookup_by_ptr(const void *ptr, int type)
 {
     /* esp_map APIs should not be called from ISR context. Hence, this assert is added */
     assert(xPortCanYield());
-    if (wrapper_index < ESP_MAP_INDEX_OFFSET || wrapper_index > (ESP_MAP_INDEX_OFFSET + allocated_handle_size)) {
-        return NULL;
+    if (!ptr) {
+        return 0;
     }
-    if (xSemaphoreTake(map_lock, TICKS_TO_WAIT) != pdPASS) {
-        return NULL;
+    int wrapper_index;
+    uint32_t seq;
+    UBaseType_t state = _esp_map_reader_enter();
+    do {
+        seq = _esp_map_read_begin();
+        wrapper_index = 0;
+        uint16_t *hash = __atomic_load_n(&map_hash, __ATOMIC_RELAXED);
+        uint32_t bits = __atomic_load_n(&map_hash_bits, __ATOMIC_RELAXED);
+        /* The table may have been replaced by a smaller one, make sure its size is the one just read */
+        if (_esp_map_read_retry(seq)) {
+            continue;
+        }
+        uint32_t mask = (1 << bits) - 1;
+        uint32_t i = _esp_map_hash(ptr, bits);
+        /* Probes are bounded as a concurrent writer may have replaced the table */
+        for (uint32_t n = 0; n <= mask && hash[i] != ESP_MAP_HASH_EMPTY; n++, i = (i + 1) & mask) {
+            int slot = hash[i] - 1;
+            if (slot >= map_slot_limit || !ESP_MAP_GET_PAGE(map_pages, slot)) {
+                break;
+            }
+            esp_map_handle_t *entry = ESP_MAP_GET_SHIM_HANDLE(map_pages, slot);
+            if (entry->handle == ptr && entry->id != ESP_MAP_FREE_ID && (!type || entry->id == type)) {
+                wrapper_index = ESP_MAP_MAKE_INDEX(slot, entry->gen);
+                break;
+            }
+        }
+    } while (_esp_map_read_retry(seq));
+    _esp_map_reader_exit(state);
+    return wrapper_index;
+}
+
+int esp_map_get_allocated_size(void)
+{
+    return allocated_handle_size;
+}
+
+void esp_map_for_each_type(int type, esp_map_iter_cb_t cb, void *arg)
+{
+    /* esp_map APIs should not be called from ISR context. Hence, this assert is added */
+    assert(xPortCanYield());
+    if (_esp_map_lock() != pdPASS) {
+        return;
     }
-    esp_map_handle_t *wrapper_handle = ESP_MAP_GET_SHIM_HANDLE(wrapper_index);
-    if (!is_valid_kdram_addr(wrapper_handle)) {
-        goto error;
+    int first_list = type ? _esp_map_type_list(type) : 0;
+    int last_list = type ? first_list : ESP_MAP_TYPE_LISTS - 1;
+    for (int list = first_list; list <= last_list; list++) {
+        uint16_t slot = map_type_head[list];
+        while (slot != ESP_MAP_LIST_END) {
+            esp_map_entry_t *entry = ESP_MAP_GET_ENTRY(map_pages, slot);
+            /* Callback may remove the entry, which moves it to the free list */
+            uint16_t next = entry->next;
+            if (!type || entry->wrapper.id == type) {
+                cb(ESP_MAP_MAKE_INDEX(slot, entry->wrapper.gen), &entry->wrapper, arg);
+            }
+            slot = next;
+        }
     }
-    xSemaphoreGive(map_lock);
-    return wrapper_handle;
-error:
-    xSemaphoreGive(map_lock);
-    return NULL;
+    _esp_map_unlock();
 }
 
-void esp_map_remove(int wrapper_index)
+void esp_map_get_usage(int *used_handles, int *total_handles, int *memory_size)
 {
     /* esp_map APIs should not be called from ISR context. Hence, this assert is added */
     assert(xPortCanYield());
-    if (xSemaphoreTake(map_lock, TICKS_TO_WAIT) != pdPASS) {
+    if (_esp_map_lock() != pdPASS) {
         return;
     }
-    esp_map_handle_t *wrapper_handle = ESP_MAP_GET_SHIM_HANDLE(wrapper_index);
-    if (wrapper_handle) {
-        memset(wrapper_handle, 0, sizeof(esp_map_handle_t));
-        free(wrapper_handle);
-        allocated_handles[wrapper_index - ESP_MAP_INDEX_OFFSET] = 0;
-    }
-    xSemaphoreGive(map_lock);
+    *used_handles = used_handle_count;
+    *total_handles = allocated_handle_size;
+    *memory_size = (allocated_handle_size / ESP_MAP_PAGE_SIZE) * sizeof(esp_map_page_t) + map_dir_size * sizeof(esp_map_page_t *) +
+                   (1 << map_hash_bits) * sizeof(uint16_t);
+    _esp_map_unlock();
 }
 
-int esp_map_get_allocated_size(void)
+void esp_map_get_stats(esp_map_stats_t *stats)
 {
-    return allocated_handle_size;
+    /* esp_map APIs should not be called from ISR context. Hence, this assert is added */
+    assert(xPortCanYield());
+    if (_esp_map_lock() != pdPASS) {
+        return;
+    }
+#if CONFIG_ESP_SYSCALL_MAP_STATS
+    *stats = map_stats;
+#else
+    memset(stats, 0, sizeof(esp_map_stats_t));
+#endif
+    stats->used_handles = used_handle_count;
+    stats->total_handles = allocated_handle_size;
+    _esp_map_unlock();
 }
@@ -0,0 +1,108 @@
+// Copyright 2020-2022 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//         http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdbool.h>
+#include <syscall_def.h>
+#include <esp_log.h>
+#include "soc_defs.h"
+#include "esp_syscall_ring.h"
+
+#define ESP_SYSCALL_RING_MASK   (ESP_SYSCALL_RING_ENTRIES - 1)
+
+_Static_assert((ESP_SYSCALL_RING_ENTRIES & ESP_SYSCALL_RING_MASK) == 0, "ESP_SYSCALL_RING_ENTRIES must be a power of 2");
+
+static const char *TAG = "esp_syscall_ring";
+
+/*
+ * esp_syscall_ring lets user app pay for one world switch for a batch of system calls.
+ * Every submission is dispatched to the regular system call implementation, so the
+ * arguments are validated exactly as they would be for a direct system call.
+ *
+ * The ring is in user app memory, so user app may modify it while it is drained.
+ * Each submission is copied before it is validated and the indices are only used
+ * masked, so this cannot make protected app access memory outside the ring.
+ */
+
+typedef void (*syscall_t)(void);
+typedef int (*esp_syscall_ring_handler_t)(uint32_t, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t);
+
+extern syscall_t esp_syscall_get_handler(uint32_t nr);
+
+/* Only system calls that neither return a handle nor run for long can be batched */
+static bool esp_syscall_ring_is_allowed(uint32_t nr)
+{
+    switch (nr) {
+    case __NR_xQueueGenericSend:
+    case __NR_xQueueReceive:
+    case __NR_xQueuePeek:
+    case __NR_xQueueGenericReset:
+    case __NR_uxQueueMessagesWaiting:
+    case __NR_uxQueueSpacesAvailable:
+    case __NR_xQueueSemaphoreTake:
+    case __NR_xQueueTakeMutexRecursive:
+    case __NR_xQueueGiveMutexRecursive:
+    case __NR_gpio_set_level:
+    case __NR_lwip_send:
+    case __NR_lwip_sendto:
+    case __NR_lwip_recv:
+    case __NR_lwip_recvfrom:
+        return true;
+    default:
+        return false;
+    }
+}
+
+int esp_syscall_ring_enter(esp_syscall_ring_t *ring, uint32_t to_submit)
+{
+    if (!is_valid_udram_addr(ring) || !is_valid_udram_addr((void *)((int)ring + sizeof(esp_syscall_ring_t))) ||
+            ((int)ring & (sizeof(uint32_t) - 1))) {
+        return -1;
+    }
+
+    uint32_t sq_head = ring->sq_head;
+    uint32_t cq_tail = ring->cq_tail;
+    uint32_t done;
+
+    for (done = 0; done < to_submit; done++) {
+        uint32_t sq_tail = ring->sq_tail;
+        if (sq_tail - sq_head > ESP_SYSCALL_RING_ENTRIES || cq_tail - ring->cq_head > ESP_SYSCALL_RING_ENTRIES) {
+            ESP_LOGE(TAG, "Ring %p has corrupted indices", ring);
+            return -1;
+        }
+        if (sq_tail == sq_head || cq_tail - ring->cq_head == ESP_SYSCALL_RING_ENTRIES) {
+            break;
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        esp_syscall_sqe_t sqe = ring->sq[sq_head & ESP_SYSCALL_RING_MASK];
+
+        esp_syscall_cqe_t cqe = {
+            .user_data = sqe.user_data,
+            .err = ESP_ERR_NOT_SUPPORTED,
+        };
+        if (esp_syscall_ring_is_allowed(sqe.nr)) {
+            esp_syscall_ring_handler_t handler = (esp_syscall_ring_handler_t)esp_syscall_get_handler(sqe.nr);
+            cqe.res = handler(sqe.args[0], sqe.args[1], sqe.args[2], sqe.args[3], sqe.args[4], sqe.args[5]);
+            cqe.err = ESP_OK;
+        }
+        ring->cq[cq_tail & ESP_SYSCALL_RING_MASK] = cqe;
+
+        sq_head++;
+        cq_tail++;
+        /* Publish the completion before user app can see the new indices */
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        ring->sq_head = sq_head;
+        ring->cq_tail = cq_tail;
+    }
+    return done;
+}
@@ -1,18 +1,58 @@
+#include <stdint.h>
 #include "syscall_def.h"
 #include "syscall_dec.h"
 
 typedef void (*syscall_t)(void);
 
-#ifdef __GNUC__
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Woverride-init"
-#endif
-const syscall_t syscall_table[__NR_syscalls] = {
-    [0 ... __NR_syscalls - 1] = (syscall_t)&sys_ni_syscall,
+/*
+ * System calls are dispatched through a two level table, as the system call numbers are sparse.
+ * syscall_groups is indexed by nr >> __NR_GROUP_SHIFT and holds the table of the group along with
+ * its size. The table of a group is indexed by the lower bits of nr and only spans up to the highest
+ * number used in the group. The ret64 array of a group is indexed the same way and tells whether a system
+ * call returns a 64-bit value, the upper word of which is handed back to user app in a1 (RISC-V) or
+ * a3 (Xtensa). The system call handlers depend on this layout.
+ */
+typedef struct {
+    const syscall_t *table;
+    uint32_t size;
+    const uint8_t *ret64;
+} __attribute__((aligned(16))) syscall_group_t;
 
-#define __SYSCALL(nr, symbol, nargs)  [nr] = (syscall_t)symbol,
+_Static_assert(sizeof(syscall_group_t) == 16, "System call handlers expect 16 bytes per syscall group");
+
+#define __SYSCALL_GROUP(grp)            static const syscall_t syscall_group_##grp[] = {
+#define __SYSCALL(nr, symbol, ret64)        (syscall_t)symbol,
+#define __SYSCALL_GROUP_END(grp)        };
+#include "esp_syscall.h"
+#undef __SYSCALL_GROUP
+#undef __SYSCALL
+#undef __SYSCALL_GROUP_END
+
+#define __SYSCALL_GROUP(grp)            static const uint8_t syscall_ret64_##grp[] = {
+#define __SYSCALL(nr, symbol, ret64)        ret64,
+#define __SYSCALL_GROUP_END(grp)        };
+#include "esp_syscall.h"
+#undef __SYSCALL_GROUP
+#undef __SYSCALL
+#undef __SYSCALL_GROUP_END
+
+#define __SYSCALL_GROUP(grp)            [grp] = { syscall_group_##grp, sizeof(syscall_group_##grp) / sizeof(syscall_t), syscall_ret64_##grp },
+#define __SYSCALL(nr, symbol, ret64)
+#define __SYSCALL_GROUP_END(grp)
+const syscall_group_t syscall_groups[__NR_groups] = {
 #include "esp_syscall.h"
 };
-#ifdef __GNUC__
-#pragma GCC diagnostic pop
-#endif
+#undef __SYSCALL_GROUP
+#undef __SYSCALL
+#undef __SYSCALL_GROUP_END
+
+syscall_t esp_syscall_get_handler(uint32_t nr)
+{
+    uint32_t group = nr >> __NR_GROUP_SHIFT;
+    uint32_t index = nr & ((1 << __NR_GROUP_SHIFT) - 1);
+
+    if (group >= __NR_groups || index >= syscall_groups[group].size) {
+        return (syscall_t)&sys_ni_syscall;
+    }
+    return syscall_groups[group].table[index];
+}
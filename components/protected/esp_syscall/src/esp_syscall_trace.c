@@ -0,0 +1,136 @@
+// Copyright 2020-2022 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//         http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+#include <sys/param.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_log.h>
+#include "hal/cpu_hal.h"
+#include "esp_syscall_trace.h"
+
+#define HIST_FIRST_BUCKET_SHIFT     8
+
+static const char *TAG = "esp_syscall_trace";
+
+/*
+ * esp_syscall_trace is called by the system call handler once a system call returns,
+ * with the cycle count sampled before the system call was dispatched. The time spent
+ * switching worlds is not accounted, only the time spent in protected app.
+ *
+ * Statistics are kept in a small open addressed table indexed by system call number,
+ * as system call numbers are sparse. A slot is taken the first time a number is called.
+ */
+
+typedef struct {
+    esp_syscall_trace_stats_t slots[CONFIG_ESP_SYSCALL_TRACE_SYSCALLS];
+    esp_syscall_trace_record_t records[CONFIG_ESP_SYSCALL_TRACE_RECORDS];
+    uint32_t record_count;                  // Free running, the next record is written at record_count % RECORDS
+    bool full_warned;
+} esp_syscall_trace_t;
+
+static esp_syscall_trace_t trace;
+static portMUX_TYPE trace_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static inline int hist_bucket(uint32_t cycles)
+{
+    int log2 = 31 - __builtin_clz(cycles | 1);
+    int bucket = log2 - HIST_FIRST_BUCKET_SHIFT;
+    if (bucket < 0) {
+        return 0;
+    }
+    return bucket < ESP_SYSCALL_TRACE_HIST_BUCKETS ? bucket : ESP_SYSCALL_TRACE_HIST_BUCKETS - 1;
+}
+
+static esp_syscall_trace_stats_t *get_slot(uint32_t nr)
+{
+    uint32_t i = nr % CONFIG_ESP_SYSCALL_TRACE_SYSCALLS;
+    for (int probe = 0; probe < CONFIG_ESP_SYSCALL_TRACE_SYSCALLS; probe++) {
+        esp_syscall_trace_stats_t *slot = &trace.slots[i];
+        if (slot->count == 0) {
+            slot->nr = nr;
+            return slot;
+        }
+        if (slot->nr == nr) {
+            return slot;
+        }
+        i = (i + 1) % CONFIG_ESP_SYSCALL_TRACE_SYSCALLS;
+    }
+    return NULL;
+}
+
+void esp_syscall_trace_record(uint32_t nr, uint32_t start_cycles)
+{
+    uint32_t cycles = cpu_hal_get_cycle_count() - start_cycles;
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    bool warn = false;
+
+    portENTER_CRITICAL(&trace_lock);
+    esp_syscall_trace_stats_t *slot = get_slot(nr);
+    if (slot) {
+        slot->count++;
+        slot->total_cycles += cycles;
+        if (cycles > slot->max_cycles) {
+            slot->max_cycles = cycles;
+        }
+        slot->hist[hist_bucket(cycles)]++;
+    } else if (!trace.full_warned) {
+        trace.full_warned = true;
+        warn = true;
+    }
+
+    esp_syscall_trace_record_t *record = &trace.records[trace.record_count % CONFIG_ESP_SYSCALL_TRACE_RECORDS];
+    record->nr = nr;
+    record->cycles = cycles;
+    record->start_cycles = start_cycles;
+    record->task = task;
+    trace.record_count++;
+    portEXIT_CRITICAL(&trace_lock);
+
+    if (warn) {
+        ESP_LOGW(TAG, "Statistics table is full, increase CONFIG_ESP_SYSCALL_TRACE_SYSCALLS");
+    }
+}
+
+esp_err_t esp_syscall_trace_get_stats(uint32_t index, esp_syscall_trace_stats_t *stats)
+{
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+
+    portENTER_CRITICAL(&trace_lock);
+    for (int i = 0; i < CONFIG_ESP_SYSCALL_TRACE_SYSCALLS; i++) {
+        if (trace.slots[i].count == 0) {
+            continue;
+        }
+        if (index-- == 0) {
+            *stats = trace.slots[i];
+            ret = ESP_OK;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&trace_lock);
+    return ret;
+}
+
+int esp_syscall_trace_get_records(esp_syscall_trace_record_t *records, uint32_t max_records)
+{
+    portENTER_CRITICAL(&trace_lock);
+    uint32_t count = MIN(trace.record_count, CONFIG_ESP_SYSCALL_TRACE_RECORDS);
+    count = MIN(count, max_records);
+    uint32_t first = trace.record_count - count;
+    for (uint32_t i = 0; i < count; i++) {
+        records[i] = trace.records[(first + i) % CONFIG_ESP_SYSCALL_TRACE_RECORDS];
+    }
+    portEXIT_CRITICAL(&trace_lock);
+    return count;
+}
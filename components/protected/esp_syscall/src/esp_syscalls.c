@@ -32,6 +32,22 @@
 #include <esp_user_ota.h>
 #include "syscall_structs.h"
 #include "esp_map.h"
+#include "esp_futex.h"
+#if CONFIG_ESP_SYSCALL_VDSO
+#include "esp_vdso.h"
+#endif
+#if CONFIG_ESP_SYSCALL_LOG_RING
+#include "esp_log_ring.h"
+#endif
+#if CONFIG_ESP_SYSCALL_RING
+#include "esp_syscall_ring.h"
+#endif
+#if CONFIG_ESP_SYSCALL_TRACE
+#include "esp_syscall_trace.h"
+#endif
+#if CONFIG_ESP_SYSCALL_KERNEL_STACK_POOL
+#include "esp_kernel_stack_pool.h"
+#endif
 
 #include <lwip/sockets.h>
 #include <lwip/netdb.h>
@@ -58,6 +74,9 @@
 
 #include <driver/uart.h>
 
+/* Typed prototypes of the system calls with a signature in syscall.tbl */
+#include "syscall_proto.h"
+
 #define TAG     __func__
 
 typedef void (*syscall_t)(void);
@@ -327,6 +346,8 @@ int sys_xTaskCreate(TaskFunction_t pvTaskCode,
         goto failure;
     }
 
+#if !CONFIG_ESP_SYSCALL_KERNEL_STACK_POOL
+    /* With the kernel stack pool, the task is given a kernel stack only while it executes a system call */
     kernel_stack = heap_caps_malloc(KERNEL_STACK_SIZE, portStackMemoryCaps);
     if (kernel_stack == NULL) {
         ESP_LOGE(TAG, "Insufficient memory for kernel stack");
@@ -334,6 +355,10 @@ int sys_xTaskCreate(TaskFunction_t pvTaskCode,
         goto failure;
     }
     memset(kernel_stack, tskSTACK_FILL_BYTE, KERNEL_STACK_SIZE * sizeof(StackType_t));
+#else
+    /* Make sure the first system call of the task finds a kernel stack in the pool */
+    esp_kernel_stack_pool_refill();
+#endif
 
     usr_errno = task_ctx->task_errno;
     if (!is_valid_udram_addr(usr_errno)) {
@@ -344,11 +369,12 @@ int sys_xTaskCreate(TaskFunction_t pvTaskCode,
 
     *usr_errno = 0;
 
-    int wrapper_index = esp_map_add(NULL, ESP_MAP_TASK_ID);
+    /* Handle of a statically created task is the address of its TCB, so it can be mapped upfront */
+    int wrapper_index = esp_map_add(xtaskTCB, ESP_MAP_TASK_ID);
     if (!wrapper_index) {
+        err = errCOULD_NOT_ALLOCATE_REQUIRED_MEMORY;
         goto failure;
     }
-    esp_map_handle_t *wrapper_handle = esp_map_get_handle(wrapper_index);
 
     /* Suspend the scheduler to ensure that it does not switch to the newly created task.
      * We need to first set the kernel stack as a TLS and only then it should be executed
@@ -356,8 +382,6 @@ int sys_xTaskCreate(TaskFunction_t pvTaskCode,
     vTaskSuspendAll();
     handle = xTaskCreateStaticPinnedToCore(pvTaskCode, pcName, stack_size, pvParameters, uxPriority, xtaskStack, xtaskTCB, xCoreID);
 
-    wrapper_handle->handle = handle;
-
     // The 1st (0th index) TLS pointer is used by pthread
     // 2nd TLS pointer is used to store the kernel stack, used when servicing system calls
     // 3rd TLS pointer is used to store the WORLD of the task. 0 = WORLD0 and 1 = WORLD1
@@ -390,9 +414,9 @@ failure:
 
 void vPortCleanUpTCB (void *pxTCB)
 {
-    if (pvTaskGetThreadLocalStoragePointer(pxTCB, ESP_PA_TLS_OFFSET_KERN_STACK) == NULL) {
+    if (pvTaskGetThreadLocalStoragePointer(pxTCB, ESP_PA_TLS_OFFSET_USER_TASK) == NULL) {
         /* This means this task is a kernel task.
-         * User task has a kernel stack at this index
+         * User task has its errno set at this index
          * Do nothing and return*/
         return;
     }
@@ -400,6 +424,9 @@ void vPortCleanUpTCB (void *pxTCB)
     void *usr_ptr;
     void *curr_stack = pxTaskGetStackStart(pxTCB);
 
+    /* The task may have been deleted while blocked on a futex, its waiter is on the kernel stack */
+    esp_futex_task_deleted(pxTCB);
+
     int wrapper_index = (int)pvTaskGetThreadLocalStoragePointer(pxTCB, ESP_PA_TLS_OFFSET_SHIM_HANDLE);
     esp_map_remove(wrapper_index);
 
@@ -419,7 +446,12 @@ void vPortCleanUpTCB (void *pxTCB)
 #elif CONFIG_IDF_TARGET_ARCH_RISCV
         RvEcallFrame *syscall_stack = (RvEcallFrame *)((uint32_t)pxTaskGetStackStart(pxTCB) + KERNEL_STACK_SIZE - RV_ESTK_FRMSZ);
         usr_ptr = (void *)syscall_stack->stack;
+#if CONFIG_ESP_SYSCALL_KERNEL_STACK_POOL
+        /* The task will never return to user space to give the kernel stack back */
+        esp_kernel_stack_pool_put(curr_stack);
+#else
         free(curr_stack);
+#endif
 #endif
     }
 
@@ -492,7 +524,7 @@ void sys_vTaskPrioritySet(TaskHandle_t xTask, UBaseType_t uxNewPriority)
 UBaseType_t sys_uxTaskPriorityGetFromISR(const TaskHandle_t xTask)
 {
     int wrapper_index = (int)xTask;
-    esp_map_handle_t *wrapper_handle = esp_map_verify(wrapper_index, ESP_MAP_TASK_ID);
+    esp_map_handle_t *wrapper_handle = esp_map_verify_from_isr(wrapper_index, ESP_MAP_TASK_ID);
     if (wrapper_handle == NULL) {
         return -1;
     }
@@ -525,7 +557,7 @@ void sys_vTaskResume(TaskHandle_t xTaskToResume)
 BaseType_t sys_xTaskResumeFromISR(TaskHandle_t xTaskToResume)
 {
     int wrapper_index = (int)xTaskToResume;
-    esp_map_handle_t *wrapper_handle = esp_map_verify(wrapper_index, ESP_MAP_TASK_ID);
+    esp_map_handle_t *wrapper_handle = esp_map_verify_from_isr(wrapper_index, ESP_MAP_TASK_ID);
     if (wrapper_handle == NULL) {
         return -1;
     }
@@ -663,7 +695,7 @@ BaseType_t sys_xTaskGenericNotifyFromISR(TaskHandle_t xTaskToNotify, UBaseType_t
     }
 
     int wrapper_index = (int)xTaskToNotify;
-    esp_map_handle_t *wrapper_handle = esp_map_verify(wrapper_index, ESP_MAP_TASK_ID);
+    esp_map_handle_t *wrapper_handle = esp_map_verify_from_isr(wrapper_index, ESP_MAP_TASK_ID);
     if (wrapper_handle == NULL) {
         return -1;
     }
@@ -681,7 +713,7 @@ void sys_vTaskNotifyGiveFromISR(TaskHandle_t xTaskToNotify, BaseType_t *pxHigher
     }
 
     int wrapper_index = (int)xTaskToNotify;
-    esp_map_handle_t *wrapper_handle = esp_map_verify(wrapper_index, ESP_MAP_TASK_ID);
+    esp_map_handle_t *wrapper_handle = esp_map_verify_from_isr(wrapper_index, ESP_MAP_TASK_ID);
     if (wrapper_handle == NULL) {
         return;
     }
@@ -932,7 +964,7 @@ BaseType_t sys_xQueueGenericSendFromISR(QueueHandle_t xQueue, const void * const
 
     if (is_valid_user_d_addr((void *)pvItemToQueue)) {
         int wrapper_index = (int)xQueue;
-        esp_map_handle_t *wrapper_handle = esp_map_verify(wrapper_index, ESP_MAP_QUEUE_ID);
+        esp_map_handle_t *wrapper_handle = esp_map_verify_from_isr(wrapper_index, ESP_MAP_QUEUE_ID);
         if (wrapper_handle == NULL) {
             return 0;
         }
@@ -963,7 +995,7 @@ BaseType_t sys_xQueueReceiveFromISR(QueueHandle_t xQueue, void * const pvBuffer,
 
     if (is_valid_udram_addr((void *)pvBuffer)) {
         int wrapper_index = (int)xQueue;
-        esp_map_handle_t *wrapper_handle = esp_map_verify(wrapper_index, ESP_MAP_QUEUE_ID);
+        esp_map_handle_t *wrapper_handle = esp_map_verify_from_isr(wrapper_index, ESP_MAP_QUEUE_ID);
         if (wrapper_handle == NULL) {
             return 0;
         }
@@ -986,7 +1018,7 @@ UBaseType_t sys_uxQueueMessagesWaiting(const QueueHandle_t xQueue)
 UBaseType_t sys_uxQueueMessagesWaitingFromISR(const QueueHandle_t xQueue)
 {
     int wrapper_index = (int)xQueue;
-    esp_map_handle_t *wrapper_handle = esp_map_verify(wrapper_index, ESP_MAP_QUEUE_ID);
+    esp_map_handle_t *wrapper_handle = esp_map_verify_from_isr(wrapper_index, ESP_MAP_QUEUE_ID);
     if (wrapper_handle == NULL) {
         return 0;
     }
@@ -1031,7 +1063,7 @@ BaseType_t sys_xQueuePeekFromISR(QueueHandle_t xQueue,  void * const pvBuffer)
 {
     if (is_valid_udram_addr((void *)pvBuffer)) {
         int wrapper_index = (int)xQueue;
-        esp_map_handle_t *wrapper_handle = esp_map_verify(wrapper_index, ESP_MAP_QUEUE_ID);
+        esp_map_handle_t *wrapper_handle = esp_map_verify_from_isr(wrapper_index, ESP_MAP_QUEUE_ID);
         if (wrapper_handle == NULL) {
             return 0;
         }
@@ -1044,7 +1076,7 @@ BaseType_t sys_xQueuePeekFromISR(QueueHandle_t xQueue,  void * const pvBuffer)
 BaseType_t sys_xQueueIsQueueEmptyFromISR(const QueueHandle_t xQueue)
 {
     int wrapper_index = (int)xQueue;
-    esp_map_handle_t *wrapper_handle = esp_map_verify(wrapper_index, ESP_MAP_QUEUE_ID);
+    esp_map_handle_t *wrapper_handle = esp_map_verify_from_isr(wrapper_index, ESP_MAP_QUEUE_ID);
     if (wrapper_handle == NULL) {
         return 0;
     }
@@ -1054,7 +1086,7 @@ BaseType_t sys_xQueueIsQueueEmptyFromISR(const QueueHandle_t xQueue)
 BaseType_t sys_xQueueIsQueueFullFromISR(const QueueHandle_t xQueue)
 {
     int wrapper_index = (int)xQueue;
-    esp_map_handle_t *wrapper_handle = esp_map_verify(wrapper_index, ESP_MAP_QUEUE_ID);
+    esp_map_handle_t *wrapper_handle = esp_map_verify_from_isr(wrapper_index, ESP_MAP_QUEUE_ID);
     if (wrapper_handle == NULL) {
         return 0;
     }
@@ -1109,7 +1141,7 @@ QueueSetMemberHandle_t sys_xQueueSelectFromSet(QueueSetHandle_t xQueueSet, TickT
 QueueSetMemberHandle_t sys_xQueueSelectFromSetFromISR(QueueSetHandle_t xQueueSet)
 {
     int wrapper_index = (int)xQueueSet;
-    esp_map_handle_t *wrapper_handle = esp_map_verify(wrapper_index, ESP_MAP_QUEUE_ID);
+    esp_map_handle_t *wrapper_handle = esp_map_verify_from_isr(wrapper_index, ESP_MAP_QUEUE_ID);
     if (wrapper_handle == NULL) {
         return NULL;
     }
@@ -1196,7 +1228,7 @@ BaseType_t sys_xQueueGiveFromISR(QueueHandle_t xQueue, BaseType_t * const pxHigh
     }
 
     int wrapper_index = (int)xQueue;
-    esp_map_handle_t *wrapper_handle = esp_map_verify(wrapper_index, ESP_MAP_QUEUE_ID);
+    esp_map_handle_t *wrapper_handle = esp_map_verify_from_isr(wrapper_index, ESP_MAP_QUEUE_ID);
     if (wrapper_handle == NULL) {
         return 0;
     }
@@ -2129,15 +2161,135 @@ int sys_uart_read_bytes(uart_port_t uart_num, void* buf, uint32_t length, TickTy
 
 esp_err_t sys_esp_get_protected_heap_stats(protected_heap_stats_t *stats)
 {
-    if (!is_valid_udram_addr(stats)) {
+    if (!is_valid_udram_addr(stats) || !is_valid_udram_addr((void *)((int)stats + sizeof(protected_heap_stats_t)))) {
         return ESP_ERR_INVALID_ARG;
     }
     stats->free_heap_size = heap_caps_get_free_size(MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL);
     stats->largest_free_block = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL);
     stats->min_free_heap = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL);
+    esp_map_get_usage(&stats->map_used_handles, &stats->map_total_handles, &stats->map_memory_size);
     return ESP_OK;
 }
 
+esp_err_t sys_esp_map_get_stats(esp_map_stats_t *stats)
+{
+    if (!is_valid_udram_addr(stats) || !is_valid_udram_addr((void *)((int)stats + sizeof(esp_map_stats_t)))) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_map_get_stats(stats);
+#if CONFIG_ESP_SYSCALL_MAP_STATS
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+esp_err_t sys_esp_vdso_register(esp_vdso_data_t *vdso)
+{
+#if CONFIG_ESP_SYSCALL_VDSO
+    return esp_vdso_register(vdso);
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+int sys_esp_syscall_ring_enter(esp_syscall_ring_t *ring, uint32_t to_submit)
+{
+#if CONFIG_ESP_SYSCALL_RING
+    return esp_syscall_ring_enter(ring, to_submit);
+#else
+    return -1;
+#endif
+}
+
+esp_err_t sys_esp_syscall_trace_get_stats(uint32_t index, esp_syscall_trace_stats_t *stats)
+{
+#if CONFIG_ESP_SYSCALL_TRACE
+    if (!is_valid_udram_addr(stats) || !is_valid_udram_addr((void *)((int)stats + sizeof(esp_syscall_trace_stats_t)))) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return esp_syscall_trace_get_stats(index, stats);
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+int sys_esp_syscall_trace_get_records(esp_syscall_trace_record_t *records, uint32_t max_records)
+{
+#if CONFIG_ESP_SYSCALL_TRACE
+    if (max_records > CONFIG_ESP_SYSCALL_TRACE_RECORDS) {
+        max_records = CONFIG_ESP_SYSCALL_TRACE_RECORDS;
+    }
+    if (!is_valid_udram_addr(records) ||
+            !is_valid_udram_addr((void *)((int)records + max_records * sizeof(esp_syscall_trace_record_t)))) {
+        return -1;
+    }
+    if (max_records == 0) {
+        return 0;
+    }
+    /* Raw task handles must never reach user memory, not even briefly, translate the records aside */
+    esp_syscall_trace_record_t *kernel_records = heap_caps_malloc(max_records * sizeof(esp_syscall_trace_record_t),
+                                                                  MALLOC_CAP_DEFAULT | MALLOC_CAP_INTERNAL);
+    if (!kernel_records) {
+        return -1;
+    }
+    int count = esp_syscall_trace_get_records(kernel_records, max_records);
+    /* Report the handles known to user app instead */
+    for (int i = 0; i < count; i++) {
+        int wrapper_index = esp_map_lookup_by_ptr(kernel_records[i].task, ESP_MAP_TASK_ID);
+        kernel_records[i].task = (wrapper_index > 0) ? (TaskHandle_t)wrapper_index : NULL;
+    }
+    memcpy(records, kernel_records, count * sizeof(esp_syscall_trace_record_t));
+    free(kernel_records);
+    return count;
+#else
+    return -1;
+#endif
+}
+
+int sys_esp_futex(volatile uint32_t *uaddr, int op, uint32_t val, TickType_t timeout)
+{
+    if (((uint32_t)uaddr & 0x3) || !is_valid_udram_addr((void *)uaddr) ||
+            !is_valid_udram_addr((void *)((int)uaddr + sizeof(uint32_t)))) {
+        return -1;
+    }
+    switch (op) {
+        case ESP_FUTEX_WAIT:
+            return esp_futex_wait(uaddr, val, timeout);
+        case ESP_FUTEX_WAKE:
+            return esp_futex_wake(uaddr, val, NULL);
+        case ESP_FUTEX_WAKE_FROM_ISR: {
+            BaseType_t task_woken = pdFALSE;
+            esp_futex_wake(uaddr, val, &task_woken);
+            return task_woken;
+        }
+        case ESP_FUTEX_LOCK_PI:
+            return esp_futex_lock_pi(uaddr, (uint32_t)pvTaskGetThreadLocalStoragePointer(NULL, ESP_PA_TLS_OFFSET_SHIM_HANDLE), timeout);
+        case ESP_FUTEX_UNLOCK_PI:
+            return esp_futex_unlock_pi(uaddr, (uint32_t)pvTaskGetThreadLocalStoragePointer(NULL, ESP_PA_TLS_OFFSET_SHIM_HANDLE));
+        default:
+            return -1;
+    }
+}
+
+esp_err_t sys_esp_log_ring_register(esp_log_ring_t *ring)
+{
+#if CONFIG_ESP_SYSCALL_LOG_RING
+    return esp_log_ring_register(ring);
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+esp_err_t sys_esp_log_ring_flush(void)
+{
+#if CONFIG_ESP_SYSCALL_LOG_RING
+    return esp_log_ring_flush();
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
 IRAM_ATTR esp_err_t esp_syscall_spawn_user_task(void *user_entry, int stack_sz, usr_custom_app_desc_t *app_desc)
 {
     usr_task_ctx_t task_ctx = {};
@@ -2173,58 +2325,133 @@ esp_err_t sys_esp_ota_user_app(char *url, int len)
     return ESP_OK;
 }
 
+static void esp_syscall_delete_user_resource(int wrapper_index, esp_map_handle_t *wrapper_handle)
+{
+    switch (ESP_MAP_GET_ID(wrapper_handle)) {
+        case ESP_MAP_QUEUE_ID:
+            vQueueDelete((QueueHandle_t)wrapper_handle->handle);
+            esp_map_remove(wrapper_index);
+            break;
+
+        case ESP_MAP_TASK_ID:
+            vTaskDelete((TaskHandle_t)wrapper_handle->handle);
+            break;
+
+        case ESP_MAP_ESP_TIMER_ID:
+            esp_timer_stop((esp_timer_handle_t)wrapper_handle->handle);
+            esp_timer_delete((esp_timer_handle_t)wrapper_handle->handle);
+            esp_map_remove(wrapper_index);
+            break;
+
+        case ESP_MAP_XTIMER_ID:
+            xTimerDelete((TimerHandle_t)wrapper_handle->handle, 0);
+            esp_map_remove(wrapper_index);
+            break;
+
+        case ESP_MAP_EVENT_GROUP_ID:
+            vEventGroupDelete((EventGroupHandle_t)wrapper_handle->handle);
+            esp_map_remove(wrapper_index);
+            break;
+
+        case ESP_MAP_GPIO_ID:
+            sys_gpio_softisr_handler_remove((usr_gpio_handle_t)wrapper_index);
+            break;
+
+        default:
+            break;
+    }
+}
+
+typedef struct {
+    int *indices;
+    int count;
+    int size;
+} user_resource_list_t;
+
+static void esp_syscall_collect_user_resource(int wrapper_index, esp_map_handle_t *wrapper_handle, void *arg)
+{
+    user_resource_list_t *list = arg;
+
+    if (list->count < list->size) {
+        list->indices[list->count] = wrapper_index;
+    }
+    list->count++;
+}
+
+static void esp_syscall_delete_user_resources(int type)
+{
+    user_resource_list_t list = { 0 };
+    int used_handles, total_handles, memory_size;
+
+    /* Resources are only collected while esp_map lock is held and deleted once it is released,
+     * as deleting a task makes the idle task remove it from esp_map, and the idle task must not block.
+     */
+    do {
+        free(list.indices);
+        esp_map_get_usage(&used_handles, &total_handles, &memory_size);
+        if (used_handles == 0) {
+            return;
+        }
+        list.indices = heap_caps_malloc(used_handles * sizeof(int), MALLOC_CAP_DEFAULT | MALLOC_CAP_INTERNAL);
+        if (!list.indices) {
+            ESP_LOGE(TAG, "Failed to allocate memory to delete user_app resources");
+            return;
+        }
+        list.size = used_handles;
+        list.count = 0;
+        esp_map_for_each_type(type, esp_syscall_collect_user_resource, &list);
+    } while (list.count > list.size);
+
+    for (int i = 0; i < list.count; i++) {
+        esp_map_handle_t *wrapper_handle = esp_map_verify(list.indices[i], type);
+        if (wrapper_handle) {
+            esp_syscall_delete_user_resource(list.indices[i], wrapper_handle);
+        }
+    }
+    free(list.indices);
+}
+
+static void esp_syscall_report_user_resource(int wrapper_index, esp_map_handle_t *wrapper_handle, void *arg)
+{
+    /* Deleted task is removed from esp_map when its TCB is cleaned up, which may be deferred */
+    if (ESP_MAP_GET_ID(wrapper_handle) != ESP_MAP_TASK_ID) {
+        ESP_EARLY_LOGW(TAG, "Map ID 0x%x not checked", ESP_MAP_GET_ID(wrapper_handle));
+    }
+}
+
 void esp_syscall_clear_user_resourses(void)
 {
+    /* User tasks are deleted first so that none of them is blocked on a resource being deleted */
+    static const int user_resource_types[] = {
+        ESP_MAP_TASK_ID,
+        ESP_MAP_GPIO_ID,
+        ESP_MAP_ESP_TIMER_ID,
+        ESP_MAP_XTIMER_ID,
+        ESP_MAP_EVENT_GROUP_ID,
+        ESP_MAP_QUEUE_ID,
+    };
+
 #ifdef CONFIG_PA_CONSOLE_ENABLE
     // Delete the uart driver used in console
     sys_uart_driver_delete(CONFIG_ESP_CONSOLE_UART_NUM);
 #endif
-    int user_handles = esp_map_get_allocated_size();
+#if CONFIG_ESP_SYSCALL_VDSO
+    // Stop updating the data page in user app memory before it is reloaded
+    esp_vdso_unregister();
+#endif
+#if CONFIG_ESP_SYSCALL_LOG_RING
+    // Write the pending user app logs and stop draining the ring before it is reloaded
+    esp_log_ring_unregister();
+#endif
     usr_dispatcher_queue_index = 0;
     usr_dispatcher_queue_handle = NULL;
     usr_mem_cleanup_queue_index = 0;
     usr_mem_cleanup_queue_handle = NULL;
     ESP_LOGI(TAG, "Deleting user_app resources");
-    for (int i = ESP_MAP_INDEX_OFFSET; i < (ESP_MAP_INDEX_OFFSET + user_handles); i++) {
-        esp_map_handle_t *wrapper_handle = esp_map_get_handle(i);
-        if (!wrapper_handle) {
-            continue;
-        }
-        switch (ESP_MAP_GET_ID(wrapper_handle)) {
-            case ESP_MAP_QUEUE_ID:
-                vQueueDelete((QueueHandle_t)wrapper_handle->handle);
-                esp_map_remove(i);
-                break;
-
-            case ESP_MAP_TASK_ID:
-                vTaskDelete((TaskHandle_t)wrapper_handle->handle);
-                break;
-
-            case ESP_MAP_ESP_TIMER_ID:
-                esp_timer_stop((esp_timer_handle_t)wrapper_handle->handle);
-                esp_timer_delete((esp_timer_handle_t)wrapper_handle->handle);
-                esp_map_remove(i);
-                break;
-
-            case ESP_MAP_XTIMER_ID:
-                xTimerDelete((TimerHandle_t)wrapper_handle->handle, 0);
-                esp_map_remove(i);
-                break;
-
-            case ESP_MAP_EVENT_GROUP_ID:
-                vEventGroupDelete((EventGroupHandle_t)wrapper_handle->handle);
-                esp_map_remove(i);
-                break;
-
-            case ESP_MAP_GPIO_ID:
-                sys_gpio_softisr_handler_remove((usr_gpio_handle_t)i);
-                break;
-
-            default:
-                ESP_EARLY_LOGW(TAG, "Map ID 0x%x not checked", ESP_MAP_GET_ID(wrapper_handle));
-                break;
-        }
+    for (int i = 0; i < sizeof(user_resource_types) / sizeof(user_resource_types[0]); i++) {
+        esp_syscall_delete_user_resources(user_resource_types[i]);
     }
+    esp_map_for_each_type(0, esp_syscall_report_user_resource, NULL);
 
     // Clear _is_user_app_up flag to enable restarting of user app
     _is_user_app_up = 0;
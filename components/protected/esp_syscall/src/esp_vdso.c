@@ -0,0 +1,110 @@
+// Copyright 2020-2022 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//         http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_attr.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_freertos_hooks.h>
+#include <esp_private/system_internal.h>
+#include "hal/cpu_hal.h"
+#include "soc_defs.h"
+#include "esp_vdso.h"
+
+#ifdef CONFIG_IDF_TARGET_ESP32C3
+#include "esp32c3/rom/ets_sys.h"
+#elif CONFIG_IDF_TARGET_ESP32S3
+#include "esp32s3/rom/ets_sys.h"
+#endif
+
+static const char *TAG = "esp_vdso";
+
+/*
+ * esp_vdso publishes the time to user app through a data page placed in user app memory.
+ * At every tick, the tick hook of each CPU samples esp_timer time along with the cycle
+ * count of that CPU, and CPU 0 also stores the tick count. User app converts the cycles
+ * elapsed since the last sample of the CPU it runs on to microseconds, so reading the time
+ * does not need a system call and is as precise as esp_timer_get_time().
+ *
+ * Each CPU sample has a sequence counter of its own, as every sample is only written by the
+ * tick hook of its CPU. It is odd while the sample is updated, and user app reads a sample
+ * again if the counter changed in the meantime.
+ *
+ * The page is in user app memory, so user app is able to modify it. Protected app never
+ * reads the page back, so this only affects the values seen by user app itself.
+ */
+
+static DRAM_ATTR esp_vdso_data_t *vdso_data;    // Page registered by user app, NULL if none
+
+static IRAM_ATTR void esp_vdso_tick_hook(void)
+{
+    esp_vdso_data_t *vdso = vdso_data;
+    if (!vdso) {
+        return;
+    }
+    int core_id = cpu_hal_get_core_id();
+    esp_vdso_cpu_t *cpu = &vdso->cpu[core_id];
+
+    /* Both samples must be taken back to back, keep higher priority interrupts out */
+    UBaseType_t state = portSET_INTERRUPT_MASK_FROM_ISR();
+    cpu->seq++;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    cpu->time_us = esp_timer_get_time();
+    cpu->ccount = cpu_hal_get_cycle_count();
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    cpu->seq++;
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(state);
+
+    if (core_id == 0) {
+        vdso->tick_count = xTaskGetTickCountFromISR();
+    }
+}
+
+esp_err_t esp_vdso_register(esp_vdso_data_t *vdso)
+{
+    if (!is_valid_udram_addr(vdso) || !is_valid_udram_addr((void *)((int)vdso + sizeof(esp_vdso_data_t))) ||
+            ((int)vdso & (sizeof(int64_t) - 1))) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (vdso_data) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    memset(vdso, 0, sizeof(esp_vdso_data_t));
+    vdso->cpu_freq_mhz = ets_get_cpu_frequency();
+    vdso->boot_time_offset_us = esp_system_get_time() - esp_timer_get_time();
+    vdso->tick_count = xTaskGetTickCount();
+    /* The samples are taken from the next tick on, until then user app falls back to system calls */
+    for (int i = 0; i < portNUM_PROCESSORS; i++) {
+        if (esp_register_freertos_tick_hook_for_cpu(esp_vdso_tick_hook, i) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to register tick hook on CPU %d", i);
+            esp_vdso_unregister();
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    vdso->version = ESP_VDSO_VERSION;
+    vdso_data = vdso;
+    return ESP_OK;
+}
+
+void esp_vdso_unregister(void)
+{
+    for (int i = 0; i < portNUM_PROCESSORS; i++) {
+        esp_deregister_freertos_tick_hook_for_cpu(esp_vdso_tick_hook, i);
+    }
+    vdso_data = NULL;
+}
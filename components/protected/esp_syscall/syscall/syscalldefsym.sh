@@ -6,12 +6,14 @@
 # syscall_tbl is the table which actually stores system call entries.
 # Where as override_tbl is used to map one symbol to another.
 # Hence, we generate defsym entries for both the tables.
+# Entries marked "user" in syscall_tbl are implemented in user app without a system call,
+# they are mapped to their usr_ implementation like "common" entries.
 syscall_tbl="$1"    # Path to syscall.tbl file
 override_tbl="$2"   # Path to override.tbl file
 
 syscall_defsym_list=$(grep -E "^[0-9A-Fa-fXx]+[[:space:]]" "$syscall_tbl" | sort -n | (
-	while read nr abi name entry ; do
-        if [ "$abi" = "common" ];
+	while read nr abi name entry sig ; do
+        if [ "$abi" = "common" ] || [ "$abi" = "user" ];
         then
             list="${list}-u usr_${name} -Wl,--wrap=${name} -Wl,--defsym=__wrap_${name}=usr_${name} "
         fi
@@ -20,7 +22,7 @@ syscall_defsym_list=$(grep -E "^[0-9A-Fa-fXx]+[[:space:]]" "$syscall_tbl" | sort
     ))
 
 override_defsym_list=$(grep -E "^[0-9A-Fa-fXx]+[[:space:]]" "$override_tbl" | sort -n | (
-	while read nr abi name entry ; do
+	while read nr abi name entry sig ; do
         if [ "$abi" = "common" ];
         then
             list="${list}-Wl,--wrap=${name} -Wl,--defsym=__wrap_${name}=${entry} "
@@ -3,6 +3,7 @@
 syscall_tbl="$1"        # [in] Path to syscall.tbl generated in build directory
 syscall_def_h="$2"      # [out] Path to syscall_def.h header file
 syscall_dec_h="$3"      # [out] Path to syscall_dec.h header file
+group_shift=8           # Must match syscalltbl.sh
 
 grep -E "^[0-9A-Fa-fXx]+[[:space:]]" "$syscall_tbl" | sort -n | (
     printf "/**\n"
@@ -14,7 +15,7 @@ grep -E "^[0-9A-Fa-fXx]+[[:space:]]" "$syscall_tbl" | sort -n | (
     printf "\n"
 
     total=0
-    while read nr abi name entry ; do
+    while read nr abi name entry sig ; do
         printf "#define __NR_%s\t%s\n" \
                 "${name}" "${nr}"
         total=$((nr+1))
@@ -23,6 +24,10 @@ grep -E "^[0-9A-Fa-fXx]+[[:space:]]" "$syscall_tbl" | sort -n | (
     printf "\n"
     printf "#define __NR_syscalls\t%s\n" "${total}"
     printf "\n"
+    printf "/* System call numbers are dispatched in groups of 1 << __NR_GROUP_SHIFT */\n"
+    printf "#define __NR_GROUP_SHIFT\t%s\n" "${group_shift}"
+    printf "#define __NR_groups\t%s\n" "$(((total - 1 >> group_shift) + 1))"
+    printf "\n"
 ) > "$syscall_def_h"
 
 grep -E "^[0-9A-Fa-fXx]+[[:space:]]" "$syscall_tbl" | sort -n | (
@@ -39,7 +44,7 @@ grep -E "^[0-9A-Fa-fXx]+[[:space:]]" "$syscall_tbl" | sort -n | (
     printf "#endif"
     printf "\n"
 
-    while read nr abi name entry ; do
+    while read nr abi name entry sig ; do
         printf "void %s(void);\n" \
                 "${entry}"
     done
@@ -0,0 +1,165 @@
+#!/bin/sh
+
+# syscallstub.sh generates typed system call stubs for the entries of syscall.tbl
+# that have a signature after the entry point, e.g.
+#
+#   1043  common  esp_timer_start_once  sys_esp_timer_start_once  esp_err_t (esp_timer_handle_t, uint64_t)
+#
+# For each such entry, a static inline __usr_<name> stub is generated for user app, which
+# marshals the arguments in the system call registers, and a prototype of the entry point is
+# generated for protected app. Arguments and return value must be integer or pointer types,
+# 64-bit values must be spelled int64_t or uint64_t and are passed as a pair of registers,
+# low word first. On Xtensa, a 64-bit argument starts on an even register, as per the windowed ABI.
+
+syscall_tbl="$1"        # [in] Path to syscall.tbl generated in build directory
+syscall_stubs_h="$2"    # [out] Path to syscall_stubs.h header file, used by user app
+syscall_proto_h="$3"    # [out] Path to syscall_proto.h header file, used by protected app
+
+stubs=$(grep -E "^[0-9A-Fa-fXx]+[[:space:]]" "$syscall_tbl" | sort -n | awk '
+function trim(s) {
+    sub(/^[ \t]+/, "", s)
+    sub(/[ \t]+$/, "", s)
+    return s
+}
+
+function is_64bit(type) {
+    return type ~ /^(const[ \t]+)?(u?int64_t|(unsigned[ \t]+)?long[ \t]+long([ \t]+int)?)$/
+}
+
+# Emit the syscall invocation for a register layout, padding 64-bit arguments to an even slot if align is set
+function invoke(align,    i, n, list, call) {
+    n = 0
+    for (i = 0; i < nargs; i++) {
+        if (is_64bit(types[i])) {
+            if (align && n % 2) {
+                slot[n++] = "0"
+            }
+            slot[n++] = "(uint32_t)arg" i
+            slot[n++] = "(uint32_t)((uint64_t)arg" i " >> 32)"
+        } else {
+            slot[n++] = "(uint32_t)arg" i
+        }
+    }
+    if (n > 6) {
+        printf("syscallstub.sh: %s needs more than 6 argument registers\n", name) > "/dev/stderr"
+        error = 1
+        exit 1
+    }
+    if (ret64) {
+        while (n < 6) {
+            slot[n++] = "0"
+        }
+        call = "__syscall6_64("
+    } else {
+        call = "__syscall" n "("
+    }
+    list = ""
+    for (i = 0; i < n; i++) {
+        list = list slot[i] ", "
+    }
+    call = call list "__NR_" name ")"
+    if (ret == "void") {
+        return "    " call ";"
+    }
+    return "    return (" ret ")" call ";"
+}
+
+{
+    sig = $0
+    sub(/^[^ \t]+[ \t]+[^ \t]+[ \t]+[^ \t]+[ \t]+[^ \t]+/, "", sig)
+    sig = trim(sig)
+    if (sig == "") {
+        next
+    }
+    name = $3
+    entry = $4
+    if (sig !~ /^[^()]+\([^()]*\)$/) {
+        printf("syscallstub.sh: invalid signature for %s: %s\n", name, sig) > "/dev/stderr"
+        error = 1
+        exit 1
+    }
+    ret = trim(substr(sig, 1, index(sig, "(") - 1))
+    args = trim(substr(sig, index(sig, "(") + 1))
+    sub(/\)$/, "", args)
+    args = trim(args)
+    ret64 = is_64bit(ret)
+
+    nargs = 0
+    if (args != "" && args != "void") {
+        nargs = split(args, types, ",")
+        for (i = 1; i <= nargs; i++) {
+            types[i - 1] = trim(types[i])
+        }
+    }
+
+    params = ""
+    protos = ""
+    for (i = 0; i < nargs; i++) {
+        params = params (i ? ", " : "") types[i] (types[i] ~ /\*$/ ? "" : " ") "arg" i
+        protos = protos (i ? ", " : "") types[i]
+    }
+    if (nargs == 0) {
+        params = "void"
+        protos = "void"
+    }
+
+    print "P" ret " " entry "(" protos ");"
+
+    print "S"
+    print "Sstatic inline __attribute__((always_inline)) " ret " __usr_" name "(" params ")"
+    print "S{"
+    rv = invoke(0)
+    xt = invoke(1)
+    if (rv == xt) {
+        print "S" rv
+    } else {
+        print "S#if CONFIG_IDF_TARGET_ARCH_XTENSA"
+        print "S" xt
+        print "S#else"
+        print "S" rv
+        print "S#endif"
+    }
+    print "S}"
+}
+
+END {
+    if (error) {
+        exit 1
+    }
+}
+') || exit 1
+
+(
+    printf "/**\n"
+    printf "  * This header file provides typed inline stubs for the system calls\n"
+    printf "  * that have a signature in syscall.tbl.\n"
+    printf "  *\n"
+    printf "  * This is AUTO GENERATED header file, please do not MODIFY!\n"
+    printf "  */\n\n"
+    printf "#pragma once\n"
+    printf "#include <stdint.h>\n"
+    printf "#include \"sdkconfig.h\"\n"
+    printf "#include \"syscall_def.h\"\n"
+    printf "#include \"syscall_macros.h\"\n"
+    printf "%s\n" "${stubs}" | sed -n 's/^S//p'
+) > "$syscall_stubs_h"
+
+(
+    printf "/**\n"
+    printf "  * This header file declares the entry points of the system calls\n"
+    printf "  * that have a signature in syscall.tbl. Include it after the headers\n"
+    printf "  * declaring the types used in the signatures.\n"
+    printf "  *\n"
+    printf "  * This is AUTO GENERATED header file, please do not MODIFY!\n"
+    printf "  */\n\n"
+    printf "#pragma once\n"
+    printf "#ifdef __cplusplus\n"
+    printf "extern \"C\" {\n"
+    printf "#endif\n"
+    printf "\n"
+    printf "%s\n" "${stubs}" | sed -n 's/^P//p'
+    printf "\n"
+    printf "#ifdef __cplusplus\n"
+    printf "}\n"
+    printf "#endif\n"
+) > "$syscall_proto_h"
@@ -3,16 +3,28 @@
 in="$1"
 out="$2"
 
+# System call numbers are split in groups of 2^group_shift numbers (see __NR_GROUP_SHIFT).
+# A table is emitted for each group that has at least one system call, it spans from the
+# first number of the group to the highest number used in the group.
+group_shift=8
+
+# The third __SYSCALL argument is 1 if the signature of the entry returns a 64-bit value,
+# the system call handlers only hand back the upper word of the return value for these.
 emit() {
 	_total="$1"
 	_nr="$2"
 	_entry="$3"
+	_sig="$4"
+	_ret64=0
 
+	if printf "%s" "${_sig%%(*}" | grep -Eq "^[[:space:]]*(const[[:space:]]+)?(u?int64_t|(unsigned[[:space:]]+)?long[[:space:]]+long([[:space:]]+int)?)[[:space:]]*$"; then
+		_ret64=1
+	fi
 	while [ $_total -lt $_nr ]; do
-		printf "__SYSCALL(%s, sys_ni_syscall, )\n" "${_total}"
+		printf "__SYSCALL(%s, sys_ni_syscall, 0)\n" "${_total}"
 		_total=$((_total+1))
 	done
-	printf "__SYSCALL(%s, %s, )\n" "${_nr}" "${_entry}"
+	printf "__SYSCALL(%s, %s, %s)\n" "${_nr}" "${_entry}" "${_ret64}"
 }
 
 dup=$(grep -wo "^[0-9]\+" "$in" | sort | uniq -d)
@@ -25,10 +37,22 @@ then
 fi
 
 grep -E "^[0-9A-Fa-fXx]+[[:space:]]" "$in" | sort -n | (
-	total=0
+	group=-1
 
-	while read nr abi name entry ; do
-		emit $((total)) $((nr)) $entry
+	while read nr abi name entry sig ; do
+		nr_group=$((nr >> group_shift))
+		if [ $nr_group -ne $group ]; then
+			if [ $group -ge 0 ]; then
+				printf "__SYSCALL_GROUP_END(%s)\n" "${group}"
+			fi
+			group=$nr_group
+			total=$((group << group_shift))
+			printf "__SYSCALL_GROUP(%s)\n" "${group}"
+		fi
+		emit $((total)) $((nr)) $entry "$sig"
 		total=$((nr+1))
 	done
+	if [ $group -ge 0 ]; then
+		printf "__SYSCALL_GROUP_END(%s)\n" "${group}"
+	fi
 ) > "$out"
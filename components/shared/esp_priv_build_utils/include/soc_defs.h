@@ -85,6 +85,14 @@ typedef enum {
     ESP_PA_TLS_OFFSET_SHIM_HANDLE,
 } esp_priv_access_tls_offset;
 
+/*
+ * TLS pointer which is set for every user task, and only for them, for the whole life of the task.
+ * WORLD is rewritten with the interrupted world on every interrupt and context switch, and KERN_STACK
+ * is NULL outside system calls with CONFIG_ESP_SYSCALL_KERNEL_STACK_POOL, so neither can tell a user
+ * task from a protected one.
+ */
+#define ESP_PA_TLS_OFFSET_USER_TASK     ESP_PA_TLS_OFFSET_ERRNO
+
 typedef struct {
     uint8_t startup_stack[CONFIG_PA_USER_MAIN_TASK_STACK_SIZE];
     uint32_t startup_errno;
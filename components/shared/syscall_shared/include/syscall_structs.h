@@ -19,7 +19,9 @@
 #include "driver/gpio.h"
 #include "esp_timer.h"
 #include "esp_event_base.h"
+#include "esp_err.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "freertos/timers.h"
 
 #ifdef __cplusplus
@@ -100,8 +102,139 @@ typedef struct {
     int free_heap_size;
     int largest_free_block;
     int min_free_heap;
+    int map_used_handles;   // Number of esp_map handles in use
+    int map_total_handles;  // Number of esp_map handles in the allocated pages
+    int map_memory_size;    // Memory used by esp_map pages, in bytes
 } protected_heap_stats_t;
 
+/* Verify misses are counted for each core handle type, and for all the other types together */
+#define ESP_MAP_STATS_TYPES     8
+
+typedef struct esp_map_stats {
+    uint32_t adds;                                      // Handles added
+    uint32_t removes;                                   // Handles removed
+    uint32_t grows;                                     // Pages added to esp_map
+    uint32_t shrinks;                                   // Empty pages freed from esp_map
+    uint32_t verify_hits;                               // Handles successfully verified
+    uint32_t verify_misses[ESP_MAP_STATS_TYPES];        // Handles rejected by verify, by handle type
+    uint32_t used_handles;                              // Handles in use
+    uint32_t peak_handles;                              // Maximum number of handles in use
+    uint32_t total_handles;                             // Handles that fit in the allocated pages
+    uint32_t lock_acquisitions;                         // Number of times esp_map lock was taken
+    uint32_t lock_max_wait_cycles;                      // Longest wait for esp_map lock, in CPU cycles
+    uint64_t lock_wait_cycles;                          // Total wait for esp_map lock, in CPU cycles
+} esp_map_stats_t;
+
+/* Layout version of esp_vdso_data_t, bumped whenever the layout changes */
+#define ESP_VDSO_VERSION        1
+
+/* Time sampled by protected app on a CPU at every tick */
+typedef struct {
+    volatile uint32_t seq;                              // Odd while protected app updates the sample, 0 until the first sample
+    uint32_t ccount;                                    // CPU cycle count at the tick
+    int64_t time_us;                                    // esp_timer time at the tick, in microseconds
+} esp_vdso_cpu_t;
+
+/*
+ * Data page published by protected app to user app, see CONFIG_ESP_SYSCALL_VDSO.
+ * It is placed in user app memory and only written by protected app. User app reads it
+ * instead of making a system call for the time and tick count queries.
+ */
+typedef struct esp_vdso_data {
+    volatile uint32_t version;                          // ESP_VDSO_VERSION once the page is published, 0 before
+    uint32_t cpu_freq_mhz;                              // CPU frequency, in MHz
+    volatile TickType_t tick_count;                     // FreeRTOS tick count, updated at every tick
+    int64_t boot_time_offset_us;                        // esp_system_get_time() - esp_timer_get_time()
+    esp_vdso_cpu_t cpu[portNUM_PROCESSORS];             // Sample of each CPU, CPU cycle counters are not in sync
+} esp_vdso_data_t;
+
+/* Number of entries in each queue of esp_syscall_ring_t, must be a power of 2 */
+#define ESP_SYSCALL_RING_ENTRIES    32
+
+/* Batched system call, submitted by user app */
+typedef struct {
+    uint32_t nr;                                        // System call number, __NR_*
+    uint32_t args[6];                                   // Arguments, as passed to the system call
+    uint32_t user_data;                                 // Copied as is to the completion
+} esp_syscall_sqe_t;
+
+/* Completion of a batched system call, posted by protected app */
+typedef struct {
+    uint32_t user_data;                                 // user_data of the submission
+    int32_t res;                                        // Value returned by the system call
+    esp_err_t err;                                      // ESP_ERR_NOT_SUPPORTED if the system call cannot be batched
+} esp_syscall_cqe_t;
+
+/*
+ * Submission and completion queues shared between user app and protected app, see
+ * CONFIG_ESP_SYSCALL_RING. The indices are free running and wrap around at UINT32_MAX.
+ * User app produces submissions at sq_tail and consumes completions at cq_head.
+ * Protected app consumes submissions at sq_head and produces completions at cq_tail.
+ */
+typedef struct esp_syscall_ring {
+    volatile uint32_t sq_head;
+    volatile uint32_t sq_tail;
+    volatile uint32_t cq_head;
+    volatile uint32_t cq_tail;
+    esp_syscall_sqe_t sq[ESP_SYSCALL_RING_ENTRIES];
+    esp_syscall_cqe_t cq[ESP_SYSCALL_RING_ENTRIES];
+} esp_syscall_ring_t;
+
+/* Number of buckets in the latency histogram of a system call, see esp_syscall_trace_stats_t */
+#define ESP_SYSCALL_TRACE_HIST_BUCKETS  16
+
+/* Latency of a system call number, see CONFIG_ESP_SYSCALL_TRACE */
+typedef struct {
+    uint32_t nr;                                        // System call number, __NR_*
+    uint32_t count;                                     // Number of calls
+    uint32_t max_cycles;                                // Longest call, in CPU cycles
+    uint64_t total_cycles;                              // Time spent in all calls, in CPU cycles
+    uint32_t hist[ESP_SYSCALL_TRACE_HIST_BUCKETS];      // Bucket i counts calls of [2^(i+8), 2^(i+9)) cycles,
+                                                        // first and last buckets also count shorter and longer calls
+} esp_syscall_trace_stats_t;
+
+/* Recent system call, see CONFIG_ESP_SYSCALL_TRACE */
+typedef struct {
+    uint32_t nr;                                        // System call number, __NR_*
+    uint32_t cycles;                                    // Duration, in CPU cycles
+    uint32_t start_cycles;                              // CPU cycle count when the call started
+    TaskHandle_t task;                                  // Calling task, NULL if it was not created by user app
+} esp_syscall_trace_record_t;
+
+/* Operations of esp_futex system call */
+#define ESP_FUTEX_WAIT              0                   // Block while the futex word holds val
+#define ESP_FUTEX_WAKE              1                   // Wake up to val tasks blocked on the futex word
+#define ESP_FUTEX_LOCK_PI           2                   // Take the mutex held in the futex word, lending priority to its holder
+#define ESP_FUTEX_UNLOCK_PI         3                   // Release the mutex held in the futex word to the next blocked task
+#define ESP_FUTEX_WAKE_FROM_ISR     4                   // ESP_FUTEX_WAKE without scheduling the woken up tasks
+
+/* The futex word of a mutex holds the user task handle of its holder, or 0, along with this flag */
+#define ESP_FUTEX_WAITERS           (1U << 31)          // Tasks may be blocked on the mutex, release it through ESP_FUTEX_UNLOCK_PI
+
+/* Size of the data area of esp_log_ring_t, in bytes, must be a power of 2 */
+#ifdef CONFIG_ESP_SYSCALL_LOG_RING_SIZE
+#define ESP_LOG_RING_SIZE           CONFIG_ESP_SYSCALL_LOG_RING_SIZE
+#else
+#define ESP_LOG_RING_SIZE           1024
+#endif
+
+/* Each record is a 32-bit header followed by the log data, padded to 4 bytes */
+#define ESP_LOG_RING_RECORD_READY   (1U << 31)          // Set in the header once the data is written
+#define ESP_LOG_RING_RECORD_SIZE(len)   (sizeof(uint32_t) + (((len) + 3) & ~3U))
+
+/*
+ * Log ring shared between user app and protected app, see CONFIG_ESP_SYSCALL_LOG_RING.
+ * The indices are free running byte offsets and wrap around at UINT32_MAX.
+ * User tasks reserve records at tail and set ESP_LOG_RING_RECORD_READY in the header once
+ * the data is copied. Protected app consumes ready records at head, in order.
+ */
+typedef struct esp_log_ring {
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    volatile uint32_t dropped;                          // Log bytes dropped by user app as the ring was full
+    uint8_t buf[ESP_LOG_RING_SIZE] __attribute__((aligned(4)));
+} esp_log_ring_t;
+
 #ifdef __cplusplus
 }
 #endif
@@ -51,6 +51,15 @@ extern int _user_heap_start;
 extern int _heap_start;
 extern int _user_data_start;
 extern void user_main(void);
+#if CONFIG_ESP_SYSCALL_VDSO
+extern void usr_esp_vdso_init(void);
+#endif
+#if CONFIG_ESP_SYSCALL_LOG_RING
+extern void usr_esp_log_ring_init(void);
+#endif
+#if CONFIG_ESP_SYSCALL_USER_SEMAPHORES
+extern void usr_task_self_cache_clear(void);
+#endif
 
 /* .startup_resources section is placed at the end of .bss section and before heap start.
  *
@@ -225,6 +234,10 @@ void usr_mem_cleanup_task(void *args)
     QueueHandle_t queue = (QueueHandle_t)args;
     while(1) {
         xQueueReceive(queue, &ptr, portMAX_DELAY);
+#if CONFIG_ESP_SYSCALL_USER_SEMAPHORES
+        /* A new task may get the thread pointer of the deleted task once its stack is freed */
+        usr_task_self_cache_clear();
+#endif
         if (ptr == &startup_res.startup_stack) {
             /* The first user task is spawned by the protected app and it uses the memory reserved
              * in .startup_resources section. This memory is not added in the heap initially and when
@@ -274,6 +287,12 @@ static void user_dispatch_service_init()
 void _user_main()
 {
     usr_clear_bss();
+#if CONFIG_ESP_SYSCALL_VDSO
+    usr_esp_vdso_init();
+#endif
+#if CONFIG_ESP_SYSCALL_LOG_RING
+    usr_esp_log_ring_init();
+#endif
     heap_caps_init();
     _is_heap_initialized = 1;
     user_cleanup_service_init();
@@ -129,3 +129,25 @@ static inline uint32_t __syscall0(uint32_t syscall_num)
     return a0;
 }
 
+/*
+ * Variant of __syscall6 for system calls returning a 64-bit value in a0 and a1.
+ */
+static inline uint64_t __syscall6_64(uint32_t arg0, uint32_t arg1,
+                         uint32_t arg2, uint32_t arg3,
+                         uint32_t arg4, uint32_t arg5,
+                         uint32_t syscall_num)
+{
+    register uint32_t a0 asm ("a0") = arg0;
+    register uint32_t a1 asm ("a1") = arg1;
+    register uint32_t a2 asm ("a2") = arg2;
+    register uint32_t a3 asm ("a3") = arg3;
+    register uint32_t a4 asm ("a4") = arg4;
+    register uint32_t a5 asm ("a5") = arg5;
+    register uint32_t a7 asm ("a7") = syscall_num;
+
+    asm volatile ("ecall"
+              : "+r" (a0), "+r" (a1)
+              : "r" (a2), "r" (a3), "r" (a4), "r" (a5), "r" (a7)
+              : "memory");
+    return ((uint64_t)a1 << 32) | a0;
+}
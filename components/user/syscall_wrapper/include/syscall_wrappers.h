@@ -88,6 +88,115 @@ esp_err_t usr_esp_ota_user_app(char *url, int len);
  */
 esp_err_t usr_esp_user_ota_cancel_rollback(void);
 
+/**
+ * @brief Wait on or wake up tasks blocked on a futex word
+ *
+ * With ESP_FUTEX_WAIT, the calling task blocks if the futex word holds val, until another task
+ * calls ESP_FUTEX_WAKE on it or the timeout expires. With ESP_FUTEX_WAKE, up to val tasks blocked
+ * on the futex word are woken up, in the order they blocked. ESP_FUTEX_WAKE_FROM_ISR does the same
+ * without scheduling the woken up tasks, for FromISR APIs. The futex word must be 4 bytes aligned
+ * in user app memory.
+ *
+ * With ESP_FUTEX_LOCK_PI and ESP_FUTEX_UNLOCK_PI, the futex word holds a mutex: the user task handle
+ * of its holder, or 0, along with ESP_FUTEX_WAITERS. ESP_FUTEX_LOCK_PI takes it, blocking while it
+ * is held and lending the priority of the calling task to its holder. ESP_FUTEX_UNLOCK_PI releases it
+ * to the highest priority blocked task and drops the inherited priority. val is unused.
+ *
+ * @param uaddr Futex word
+ * @param op ESP_FUTEX_WAIT, ESP_FUTEX_WAKE, ESP_FUTEX_WAKE_FROM_ISR, ESP_FUTEX_LOCK_PI or ESP_FUTEX_UNLOCK_PI
+ * @param val Expected value for ESP_FUTEX_WAIT, number of tasks to wake up for ESP_FUTEX_WAKE and ESP_FUTEX_WAKE_FROM_ISR
+ * @param timeout Maximum time to block with ESP_FUTEX_WAIT, in ticks, portMAX_DELAY to block indefinitely
+ *
+ * @return
+ *      - ESP_FUTEX_WAIT: 0 once woken up, -1 if the futex word does not hold val or the timeout expired
+ *      - ESP_FUTEX_WAKE: Number of tasks woken up
+ *      - ESP_FUTEX_WAKE_FROM_ISR: pdTRUE if a task with a higher priority than the calling task was woken up, pdFALSE otherwise
+ *      - ESP_FUTEX_LOCK_PI: 0 once the mutex is taken, -1 if the timeout expired
+ *      - ESP_FUTEX_UNLOCK_PI: 0 once the mutex is released, -1 if the calling task does not hold it
+ *      - -1 if uaddr or op is invalid
+ */
+int usr_esp_futex(volatile uint32_t *uaddr, int op, uint32_t val, TickType_t timeout);
+
+#if CONFIG_ESP_SYSCALL_LOG_RING
+/**
+ * @brief Write the lines pending in the log ring to the console
+ *
+ * With CONFIG_ESP_SYSCALL_LOG_RING, lines printed by user app are written to the console
+ * asynchronously. Call this function to make sure they are written, e.g. before a reset.
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_STATE if the log ring is not in use
+ */
+esp_err_t usr_esp_log_ring_flush(void);
+#endif
+
+#if CONFIG_ESP_SYSCALL_RING
+/**
+ * @brief Initialize a system call ring
+ *
+ * @param ring Ring to initialize. It must stay valid as long as it is used
+ */
+void usr_esp_syscall_ring_init(esp_syscall_ring_t *ring);
+
+/**
+ * @brief Get the next free submission of a ring
+ *
+ * Fill `nr` with the system call number (__NR_*), `args` with its arguments and `user_data`
+ * with a value to identify its completion, then call usr_esp_syscall_ring_submit.
+ *
+ * @param ring Ring
+ *
+ * @return
+ *      - Pointer to the submission
+ *      - NULL if the submission queue is full
+ */
+esp_syscall_sqe_t *usr_esp_syscall_ring_get_sqe(esp_syscall_ring_t *ring);
+
+/**
+ * @brief Queue the submission returned by usr_esp_syscall_ring_get_sqe
+ *
+ * @param ring Ring
+ */
+void usr_esp_syscall_ring_submit(esp_syscall_ring_t *ring);
+
+/**
+ * @brief Execute the queued submissions with a single system call
+ *
+ * Submissions are executed in order and their results are posted to the completion queue.
+ * Completions are synchronous: the completion of every executed submission is posted by the
+ * time this function returns.
+ * Only FreeRTOS queue, gpio_set_level and socket send/receive system calls can be batched,
+ * the other ones complete with ESP_ERR_NOT_SUPPORTED.
+ *
+ * @param ring Ring
+ * @param to_submit Number of submissions to execute
+ *
+ * @return
+ *      - Number of submissions consumed
+ *      - -1 if the ring is invalid
+ */
+int usr_esp_syscall_ring_enter(esp_syscall_ring_t *ring, uint32_t to_submit);
+
+/**
+ * @brief Get the oldest completion of a ring, without consuming it
+ *
+ * @param ring Ring
+ *
+ * @return
+ *      - Pointer to the completion
+ *      - NULL if there is no completion
+ */
+esp_syscall_cqe_t *usr_esp_syscall_ring_peek_cqe(esp_syscall_ring_t *ring);
+
+/**
+ * @brief Consume the completion returned by usr_esp_syscall_ring_peek_cqe
+ *
+ * @param ring Ring
+ */
+void usr_esp_syscall_ring_cqe_seen(esp_syscall_ring_t *ring);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
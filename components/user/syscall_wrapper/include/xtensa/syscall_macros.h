@@ -133,3 +133,27 @@ static inline uint32_t __syscall0(uint32_t syscall_num)
 
     return a2;
 }
+
+/*
+ * Variant of __syscall6 for system calls returning a 64-bit value in a2 and a3.
+ */
+static inline uint64_t __syscall6_64(uint32_t arg0, uint32_t arg1,
+                         uint32_t arg2, uint32_t arg3,
+                         uint32_t arg4, uint32_t arg5,
+                         uint32_t syscall_num)
+{
+    register uint32_t a10 asm ("a10") = arg0;
+    register uint32_t a3 asm ("a3") = arg1;
+    register uint32_t a4 asm ("a4") = arg2;
+    register uint32_t a5 asm ("a5") = arg3;
+    register uint32_t a6 asm ("a6") = arg4;
+    register uint32_t a7 asm ("a7") = arg5;
+    register uint32_t a2 asm ("a2") = syscall_num;
+
+    asm volatile ("syscall"
+              : "+r" (a2), "+r" (a3)
+              : "r" (a10), "r" (a4), "r" (a5), "r" (a6), "r" (a7)
+              : "memory");
+
+    return ((uint64_t)a3 << 32) | a2;
+}
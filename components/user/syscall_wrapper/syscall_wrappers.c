@@ -15,6 +15,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <errno.h>
+#include <sys/param.h>
 #include "string.h"
 #include "esp_idf_version.h"
 #include "syscall_def.h"
@@ -24,6 +26,7 @@
 #include "freertos/event_groups.h"
 #include "syscall_wrappers.h"
 #include "syscall_structs.h"
+#include "soc_defs.h"
 #include "esp_event.h"
 #include "esp_wifi.h"
 
@@ -41,13 +44,17 @@
 
 #include <driver/uart.h>
 
+#if CONFIG_ESP_SYSCALL_VDSO
+#include "hal/cpu_hal.h"
+#endif
+
+#include "syscall_stubs.h"
+
 #ifndef XTSTR
 #define _XTSTR(x)	# x
 #define XTSTR(x)	_XTSTR(x)
 #endif
 
-static bool _is_heap_initialized;
-
 #ifdef __GNUC__
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wint-conversion"
@@ -60,14 +67,121 @@ static bool _is_heap_initialized;
  */
 //const __attribute__((section(".rodata_desc"))) uint8_t user_app_desc[256];
 
+#if CONFIG_ESP_SYSCALL_VDSO
+/* Data page updated by protected app, see esp_vdso.c in protected app */
+static esp_vdso_data_t usr_vdso_data __attribute__((aligned(8)));
+
+void usr_esp_vdso_init(void)
+{
+    EXECUTE_SYSCALL(&usr_vdso_data, __NR_esp_vdso_register);
+}
+
+static inline bool usr_vdso_is_ready(void)
+{
+    return usr_vdso_data.version == ESP_VDSO_VERSION;
+}
+
+/*
+ * Interpolate esp_timer time from the sample taken by protected app at the last tick of
+ * the CPU this task runs on. Returns false if the CPU has not been sampled yet.
+ */
+static UIRAM_ATTR bool usr_vdso_get_time(int64_t *time_us)
+{
+    esp_vdso_cpu_t *cpu;
+    uint32_t seq, ccount, now;
+    int64_t sample_us;
+    int core_id;
+
+    if (!usr_vdso_is_ready()) {
+        return false;
+    }
+    do {
+        core_id = cpu_hal_get_core_id();
+        cpu = &usr_vdso_data.cpu[core_id];
+        seq = cpu->seq;
+        if (seq == 0) {
+            return false;
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        sample_us = cpu->time_us;
+        ccount = cpu->ccount;
+        now = cpu_hal_get_cycle_count();
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        /* Retry if the sample was being updated, or if the task moved to the other CPU */
+    } while ((seq & 1) || seq != cpu->seq || core_id != cpu_hal_get_core_id());
+
+    *time_us = sample_us + (now - ccount) / usr_vdso_data.cpu_freq_mhz;
+    return true;
+}
+#endif
+
 // ROM and Newlib
 int usr_putchar(int c)
 {
     return EXECUTE_SYSCALL(c, __NR_putchar);
 }
 
+#if CONFIG_ESP_SYSCALL_LOG_RING
+/* Log ring drained by protected app, see esp_log_ring.c in protected app */
+static esp_log_ring_t usr_log_ring;
+static bool usr_log_ring_ready;
+
+#define USR_LOG_RING_MASK       (ESP_LOG_RING_SIZE - 1)
+
+void usr_esp_log_ring_init(void)
+{
+    usr_log_ring_ready = (__usr_esp_log_ring_register(&usr_log_ring) == ESP_OK);
+}
+
+/*
+ * Append a record to the log ring. The record is reserved by moving tail, then its data is
+ * copied and its header is written last, with ESP_LOG_RING_RECORD_READY, to hand it over to
+ * protected app. Returns 1 once appended, 0 if the line was dropped as the ring is full and
+ * -1 if the line cannot fit in the ring at all.
+ */
+static int usr_log_ring_write(const char *str, size_t len)
+{
+    esp_log_ring_t *ring = &usr_log_ring;
+    uint32_t size = ESP_LOG_RING_RECORD_SIZE(len);
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+
+    if (size > ESP_LOG_RING_SIZE) {
+        return -1;
+    }
+    do {
+        if (tail + size - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) > ESP_LOG_RING_SIZE) {
+            __atomic_fetch_add(&ring->dropped, len, __ATOMIC_RELAXED);
+            return 0;
+        }
+    } while (!__atomic_compare_exchange_n(&ring->tail, &tail, tail + size, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    uint32_t offset = (tail + sizeof(uint32_t)) & USR_LOG_RING_MASK;
+    size_t first = MIN(len, ESP_LOG_RING_SIZE - offset);
+    memcpy(&ring->buf[offset], str, first);
+    memcpy(&ring->buf[0], str + first, len - first);
+
+    __atomic_store_n((uint32_t *)&ring->buf[tail & USR_LOG_RING_MASK], ESP_LOG_RING_RECORD_READY | len, __ATOMIC_RELEASE);
+    return 1;
+}
+
+esp_err_t usr_esp_log_ring_flush(void)
+{
+    return __usr_esp_log_ring_flush();
+}
+#endif
+
 int usr_write_log_line(const char *str, size_t len)
 {
+#if CONFIG_ESP_SYSCALL_LOG_RING
+    if (usr_log_ring_ready) {
+        int ret = usr_log_ring_write(str, len);
+        if (ret >= 0) {
+            return ret;
+        }
+        /* Write the line directly, after the pending ones */
+        __usr_esp_log_ring_flush();
+    }
+#endif
     return EXECUTE_SYSCALL(str, len, __NR_write_log_line);
 }
 
@@ -78,7 +192,21 @@ int usr_write_log_line_unlocked(const char *str, size_t len)
 
 uint32_t usr_ets_get_cpu_frequency(void)
 {
+#if CONFIG_ESP_SYSCALL_VDSO
+    if (usr_vdso_is_ready()) {
+        return usr_vdso_data.cpu_freq_mhz;
+    }
+#endif
+#if CONFIG_PM_ENABLE
     return EXECUTE_SYSCALL(__NR_ets_get_cpu_frequency);
+#else
+    /* CPU frequency only changes at runtime with power management, query it once */
+    static uint32_t cpu_freq_mhz;
+    if (cpu_freq_mhz == 0) {
+        cpu_freq_mhz = EXECUTE_SYSCALL(__NR_ets_get_cpu_frequency);
+    }
+    return cpu_freq_mhz;
+#endif
 }
 
 void usr_esp_rom_md5_init(md5_context_t *context)
@@ -106,6 +234,257 @@ int usr_esp_rom_uart_rx_one_char(uint8_t *c)
     return EXECUTE_SYSCALL(c, __NR_esp_rom_uart_rx_one_char);
 }
 
+#if CONFIG_ESP_SYSCALL_USER_LOCKS
+/*
+ * Newlib locks are implemented in user app. The state of a __retarget_lock_* lock is kept in its
+ * struct __lock storage, the state of a _lock_* lock is allocated on first use as _lock_t only holds
+ * a pointer, which may be statically initialized to 0. The futex word is only updated with atomic
+ * instructions, protected app is entered through esp_futex when a task has to block on a lock or
+ * wake up a blocked task.
+ */
+#define USR_LOCK_UNLOCKED       0
+#define USR_LOCK_LOCKED         1
+#define USR_LOCK_CONTENDED      2       // Locked, tasks may be blocked on the lock
+
+typedef struct {
+    volatile uint32_t futex;
+    uint32_t owner;                     // Thread pointer of the task holding a recursive lock
+    uint32_t count;                     // Recursion depth of a recursive lock
+} usr_lock_t;
+
+_Static_assert(sizeof(usr_lock_t) <= sizeof(struct __lock), "usr_lock_t must fit in struct __lock");
+
+/* The FreeRTOS port sets up a thread pointer for every task, it identifies the task without a system call */
+static inline uint32_t usr_lock_self(void)
+{
+    uint32_t self;
+#if CONFIG_IDF_TARGET_ARCH_XTENSA
+    asm volatile ("rur.threadptr %0" : "=r" (self));
+#else
+    asm volatile ("mv %0, tp" : "=r" (self));
+#endif
+    return self;
+}
+
+static usr_lock_t *usr_lock_alloc(void)
+{
+    usr_lock_t *lock = calloc(1, sizeof(usr_lock_t));
+    if (lock == NULL) {
+        abort();
+    }
+    return lock;
+}
+
+static UIRAM_ATTR usr_lock_t *usr_lock_get(_lock_t *plock)
+{
+    _lock_t lock = __atomic_load_n(plock, __ATOMIC_ACQUIRE);
+
+    if (lock == 0) {
+        _lock_t new_lock = (_lock_t)usr_lock_alloc();
+        if (__atomic_compare_exchange_n(plock, &lock, new_lock, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            lock = new_lock;
+        } else {
+            /* Another task allocated it first */
+            free((void *)new_lock);
+        }
+    }
+    return (usr_lock_t *)lock;
+}
+
+static UIRAM_ATTR int usr_lock_take(usr_lock_t *lock, bool recursive, bool wait)
+{
+    uint32_t self = usr_lock_self();
+    uint32_t state = USR_LOCK_UNLOCKED;
+
+    if (recursive && __atomic_load_n(&lock->owner, __ATOMIC_RELAXED) == self) {
+        lock->count++;
+        return 0;
+    }
+    if (!__atomic_compare_exchange_n(&lock->futex, &state, USR_LOCK_LOCKED, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        if (!wait) {
+            return -1;
+        }
+        /* Mark the lock contended, so that its owner wakes this task up when releasing it */
+        if (state != USR_LOCK_CONTENDED) {
+            state = __atomic_exchange_n(&lock->futex, USR_LOCK_CONTENDED, __ATOMIC_ACQUIRE);
+        }
+        while (state != USR_LOCK_UNLOCKED) {
+            __usr_esp_futex(&lock->futex, ESP_FUTEX_WAIT, USR_LOCK_CONTENDED, portMAX_DELAY);
+            state = __atomic_exchange_n(&lock->futex, USR_LOCK_CONTENDED, __ATOMIC_ACQUIRE);
+        }
+    }
+    if (recursive) {
+        __atomic_store_n(&lock->owner, self, __ATOMIC_RELAXED);
+        lock->count = 1;
+    }
+    return 0;
+}
+
+static UIRAM_ATTR void usr_lock_give(usr_lock_t *lock, bool recursive)
+{
+    if (recursive) {
+        if (--lock->count) {
+            return;
+        }
+        __atomic_store_n(&lock->owner, 0, __ATOMIC_RELAXED);
+    }
+    if (__atomic_exchange_n(&lock->futex, USR_LOCK_UNLOCKED, __ATOMIC_RELEASE) == USR_LOCK_CONTENDED) {
+        __usr_esp_futex(&lock->futex, ESP_FUTEX_WAKE, 1, 0);
+    }
+}
+
+void usr__lock_init(_lock_t *lock)
+{
+    *lock = 0;
+}
+
+void usr__lock_init_recursive(_lock_t *lock)
+{
+    *lock = 0;
+}
+
+void usr__lock_close(_lock_t *lock)
+{
+    free((void *)*lock);
+    *lock = 0;
+}
+
+void usr__lock_close_recursive(_lock_t *lock)
+{
+    free((void *)*lock);
+    *lock = 0;
+}
+
+UIRAM_ATTR void usr__lock_acquire(_lock_t *lock)
+{
+    usr_lock_take(usr_lock_get(lock), false, true);
+}
+
+UIRAM_ATTR void usr__lock_acquire_recursive(_lock_t *lock)
+{
+    usr_lock_take(usr_lock_get(lock), true, true);
+}
+
+UIRAM_ATTR int usr__lock_try_acquire(_lock_t *lock)
+{
+    return usr_lock_take(usr_lock_get(lock), false, false);
+}
+
+UIRAM_ATTR int usr__lock_try_acquire_recursive(_lock_t *lock)
+{
+    return usr_lock_take(usr_lock_get(lock), true, false);
+}
+
+UIRAM_ATTR void usr__lock_release(_lock_t *lock)
+{
+    usr_lock_give(usr_lock_get(lock), false);
+}
+
+UIRAM_ATTR void usr__lock_release_recursive(_lock_t *lock)
+{
+    usr_lock_give(usr_lock_get(lock), true);
+}
+
+void usr___retarget_lock_init(_LOCK_T *lock)
+{
+    *lock = (_LOCK_T)usr_lock_alloc();
+}
+
+void usr___retarget_lock_init_recursive(_LOCK_T *lock)
+{
+    *lock = (_LOCK_T)usr_lock_alloc();
+}
+
+void usr___retarget_lock_close(_LOCK_T lock)
+{
+    free(lock);
+}
+
+void usr___retarget_lock_close_recursive(_LOCK_T lock)
+{
+    free(lock);
+}
+
+UIRAM_ATTR void usr___retarget_lock_acquire(_LOCK_T lock)
+{
+    usr_lock_take((usr_lock_t *)lock, false, true);
+}
+
+UIRAM_ATTR void usr___retarget_lock_acquire_recursive(_LOCK_T lock)
+{
+    usr_lock_take((usr_lock_t *)lock, true, true);
+}
+
+UIRAM_ATTR int usr___retarget_lock_try_acquire(_LOCK_T lock)
+{
+    return usr_lock_take((usr_lock_t *)lock, false, false);
+}
+
+UIRAM_ATTR int usr___retarget_lock_try_acquire_recursive(_LOCK_T lock)
+{
+    return usr_lock_take((usr_lock_t *)lock, true, false);
+}
+
+UIRAM_ATTR void usr___retarget_lock_release(_LOCK_T lock)
+{
+    usr_lock_give((usr_lock_t *)lock, false);
+}
+
+UIRAM_ATTR void usr___retarget_lock_release_recursive(_LOCK_T lock)
+{
+    usr_lock_give((usr_lock_t *)lock, true);
+}
+#else
+/* Lock creation and deletion are overridden in override.tbl, keep the newlib implementation */
+void __real__lock_init(_lock_t *lock);
+void __real__lock_init_recursive(_lock_t *lock);
+void __real__lock_close(_lock_t *lock);
+void __real__lock_close_recursive(_lock_t *lock);
+void __real___retarget_lock_init(_LOCK_T *lock);
+void __real___retarget_lock_init_recursive(_LOCK_T *lock);
+void __real___retarget_lock_close(_LOCK_T lock);
+void __real___retarget_lock_close_recursive(_LOCK_T lock);
+
+void usr__lock_init(_lock_t *lock)
+{
+    __real__lock_init(lock);
+}
+
+void usr__lock_init_recursive(_lock_t *lock)
+{
+    __real__lock_init_recursive(lock);
+}
+
+void usr__lock_close(_lock_t *lock)
+{
+    __real__lock_close(lock);
+}
+
+void usr__lock_close_recursive(_lock_t *lock)
+{
+    __real__lock_close_recursive(lock);
+}
+
+void usr___retarget_lock_init(_LOCK_T *lock)
+{
+    __real___retarget_lock_init(lock);
+}
+
+void usr___retarget_lock_init_recursive(_LOCK_T *lock)
+{
+    __real___retarget_lock_init_recursive(lock);
+}
+
+void usr___retarget_lock_close(_LOCK_T lock)
+{
+    __real___retarget_lock_close(lock);
+}
+
+void usr___retarget_lock_close_recursive(_LOCK_T lock)
+{
+    __real___retarget_lock_close_recursive(lock);
+}
+
 UIRAM_ATTR void usr__lock_acquire(_lock_t *lock)
 {
     EXECUTE_SYSCALL(lock, __NR__lock_acquire);
@@ -165,15 +544,16 @@ IRAM_ATTR void usr___retarget_lock_release_recursive(_LOCK_T lock)
 {
     EXECUTE_SYSCALL(lock, __NR___retarget_lock_release_recursive);
 }
+#endif
 
 void usr_esp_time_impl_set_boot_time(uint64_t time_us)
 {
-    EXECUTE_SYSCALL(time_us, __NR_esp_time_impl_set_boot_time);
+    __usr_esp_time_impl_set_boot_time(time_us);
 }
 
 uint64_t usr_esp_time_impl_get_boot_time(void)
 {
-    return EXECUTE_SYSCALL(__NR_esp_time_impl_get_boot_time);
+    return __usr_esp_time_impl_get_boot_time();
 }
 
 // Task Creation
@@ -304,11 +684,8 @@ int usr_xPortEnterCriticalTimeout(spinlock_t *mux, int timeout)
 
 int usr_xPortInterruptedFromISRContext(void)
 {
-#if CONFIG_IDF_TARGET_ESP32S3
-    return EXECUTE_SYSCALL(__NR_xPortInterruptedFromISRContext);
-#else
-    return -1;
-#endif
+    // User app never runs in ISR context.
+    return 0;
 }
 
 int usr_vPortSetInterruptMask(void)
@@ -416,11 +793,21 @@ TaskHandle_t usr_xTaskGetHandle(const char *pcNameToQuery)
 
 TickType_t usr_xTaskGetTickCount(void)
 {
+#if CONFIG_ESP_SYSCALL_VDSO
+    if (usr_vdso_is_ready()) {
+        return usr_vdso_data.tick_count;
+    }
+#endif
     return EXECUTE_SYSCALL(__NR_xTaskGetTickCount);
 }
 
 TickType_t usr_xTaskGetTickCountFromISR(void)
 {
+#if CONFIG_ESP_SYSCALL_VDSO
+    if (usr_vdso_is_ready()) {
+        return usr_vdso_data.tick_count;
+    }
+#endif
     return EXECUTE_SYSCALL(__NR_xTaskGetTickCountFromISR);
 }
 
@@ -434,74 +821,610 @@ UBaseType_t usr_uxTaskGetNumberOfTasks(void)
     return EXECUTE_SYSCALL(__NR_uxTaskGetNumberOfTasks);
 }
 
+#if CONFIG_ESP_SYSCALL_USER_QUEUES || CONFIG_ESP_SYSCALL_USER_SEMAPHORES
+/* Whether an object of size bytes at ptr lies in user app DRAM, so that it can be read to check its magic word */
+static inline bool usr_obj_is_valid(const void *ptr, size_t size)
+{
+    return ((uint32_t)ptr & 3) == 0 && is_valid_udram_addr((void *)ptr) && is_valid_udram_addr((uint8_t *)ptr + size - 1);
+}
+
+/* Ticks left before a timeout started at start expires, 0 once it has expired */
+static TickType_t usr_ticks_remaining(TickType_t start, TickType_t timeout)
+{
+    if (timeout == portMAX_DELAY) {
+        return portMAX_DELAY;
+    }
+    TickType_t elapsed = xTaskGetTickCount() - start;
+    return (elapsed < timeout) ? timeout - elapsed : 0;
+}
+#endif
+
+#if CONFIG_ESP_SYSCALL_USER_QUEUES
+/*
+ * Queues created by user app are kept in user app memory. The queue state is protected by a
+ * usr_lock_t, so an uncontended send or receive is a couple of atomic instructions and a copy.
+ * Tasks block on the items_seq and spaces_seq futex words, which are incremented whenever an
+ * item is added or removed, and protected app is only entered to block or to wake up a task
+ * counted in rx_waiting or tx_waiting.
+ *
+ * Handles of protected queues are esp_map handles, which are not user app memory addresses, so a
+ * user app queue is recognized by its address and its magic word.
+ */
+#define USR_QUEUE_MAGIC         0x55515545      // "EUQU"
+
+typedef struct {
+    uint32_t magic;
+    usr_lock_t lock;                    // Protects all the fields below
+    volatile uint32_t items_seq;        // Futex word, incremented whenever an item is added
+    volatile uint32_t spaces_seq;       // Futex word, incremented whenever an item is removed
+    uint32_t rx_waiting;                // Tasks blocked until an item is added
+    uint32_t tx_waiting;                // Tasks blocked until an item is removed
+    uint32_t count;
+    uint32_t head;                      // Index of the oldest item
+    uint32_t length;
+    uint32_t item_size;
+    uint8_t storage[];
+} usr_queue_t;
+
+static inline usr_queue_t *usr_queue_get(QueueHandle_t xQueue)
+{
+    usr_queue_t *queue = (usr_queue_t *)xQueue;
+
+    if (!usr_obj_is_valid(queue, sizeof(usr_queue_t)) || queue->magic != USR_QUEUE_MAGIC) {
+        return NULL;
+    }
+    return queue;
+}
+
+static QueueHandle_t usr_queue_create(uint32_t length, uint32_t item_size)
+{
+    if (length == 0 || item_size > (SIZE_MAX - sizeof(usr_queue_t)) / length) {
+        return NULL;
+    }
+    usr_queue_t *queue = calloc(1, sizeof(usr_queue_t) + length * item_size);
+    if (queue == NULL) {
+        return NULL;
+    }
+    queue->length = length;
+    queue->item_size = item_size;
+    queue->magic = USR_QUEUE_MAGIC;
+    return (QueueHandle_t)queue;
+}
+
+static void usr_queue_delete(usr_queue_t *queue)
+{
+    queue->magic = 0;
+    free(queue);
+}
+
+/* Block until seq changes, with the queue lock released. Returns false once the timeout has expired */
+static bool usr_queue_wait(usr_queue_t *queue, volatile uint32_t *seq, uint32_t *waiting, TickType_t start, TickType_t timeout)
+{
+    TickType_t remaining = usr_ticks_remaining(start, timeout);
+
+    if (remaining == 0) {
+        return false;
+    }
+
+    /* seq is only modified with the lock held, so a change after the lock is released makes the wait return at once */
+    uint32_t val = *seq;
+    (*waiting)++;
+    usr_lock_give(&queue->lock, false);
+    __usr_esp_futex(seq, ESP_FUTEX_WAIT, val, remaining);
+    usr_lock_take(&queue->lock, false, true);
+    (*waiting)--;
+    return true;
+}
+
+/* Wake up a task blocked on seq. With from_isr, it is not scheduled by the esp_futex system call but reported in task_woken */
+static void usr_queue_wake(volatile uint32_t *seq, bool from_isr, BaseType_t *task_woken)
+{
+    if (!from_isr) {
+        __usr_esp_futex(seq, ESP_FUTEX_WAKE, 1, 0);
+    } else if (__usr_esp_futex(seq, ESP_FUTEX_WAKE_FROM_ISR, 1, 0) == pdTRUE && task_woken) {
+        *task_woken = pdTRUE;
+    }
+}
+
+/* from_isr calls never block, not even on the queue lock, and fail if it is held */
+static BaseType_t usr_queue_send(usr_queue_t *queue, const void *item, TickType_t timeout, BaseType_t position,
+                                 bool from_isr, BaseType_t *task_woken)
+{
+    TickType_t start = timeout ? xTaskGetTickCount() : 0;
+
+    if (usr_lock_take(&queue->lock, false, !from_isr) != 0) {
+        return errQUEUE_FULL;
+    }
+    while (queue->count == queue->length && position != queueOVERWRITE) {
+        if (timeout == 0 || !usr_queue_wait(queue, &queue->spaces_seq, &queue->tx_waiting, start, timeout)) {
+            usr_lock_give(&queue->lock, false);
+            return errQUEUE_FULL;
+        }
+    }
+
+    uint32_t index;
+    if (queue->count == queue->length) {
+        /* queueOVERWRITE on a full queue, which is only used on queues of length 1 */
+        index = queue->head;
+    } else if (position == queueSEND_TO_FRONT) {
+        queue->head = (queue->head + queue->length - 1) % queue->length;
+        index = queue->head;
+        queue->count++;
+    } else {
+        index = (queue->head + queue->count) % queue->length;
+        queue->count++;
+    }
+    memcpy(&queue->storage[index * queue->item_size], item, queue->item_size);
+    queue->items_seq++;
+    bool wake = queue->rx_waiting != 0;
+    usr_lock_give(&queue->lock, false);
+
+    if (wake) {
+        usr_queue_wake(&queue->items_seq, from_isr, task_woken);
+    }
+    return pdTRUE;
+}
+
+static BaseType_t usr_queue_receive(usr_queue_t *queue, void *buffer, TickType_t timeout, bool peek,
+                                    bool from_isr, BaseType_t *task_woken)
+{
+    TickType_t start = timeout ? xTaskGetTickCount() : 0;
+    volatile uint32_t *seq;
+    bool wake;
+
+    if (usr_lock_take(&queue->lock, false, !from_isr) != 0) {
+        return pdFALSE;
+    }
+    while (queue->count == 0) {
+        if (timeout == 0 || !usr_queue_wait(queue, &queue->items_seq, &queue->rx_waiting, start, timeout)) {
+            usr_lock_give(&queue->lock, false);
+            return pdFALSE;
+        }
+    }
+
+    memcpy(buffer, &queue->storage[queue->head * queue->item_size], queue->item_size);
+    if (peek) {
+        /* The item is still in the queue, pass the wake up on to another blocked receiver */
+        seq = &queue->items_seq;
+        wake = queue->rx_waiting != 0;
+    } else {
+        queue->head = (queue->head + 1) % queue->length;
+        queue->count--;
+        seq = &queue->spaces_seq;
+        wake = queue->tx_waiting != 0;
+    }
+    (*seq)++;
+    usr_lock_give(&queue->lock, false);
+
+    if (wake) {
+        usr_queue_wake(seq, from_isr, task_woken);
+    }
+    return pdTRUE;
+}
+
+static BaseType_t usr_queue_reset(usr_queue_t *queue)
+{
+    usr_lock_take(&queue->lock, false, true);
+    queue->count = 0;
+    queue->head = 0;
+    queue->spaces_seq++;
+    bool wake = queue->tx_waiting != 0;
+    usr_lock_give(&queue->lock, false);
+
+    if (wake) {
+        __usr_esp_futex(&queue->spaces_seq, ESP_FUTEX_WAKE, UINT32_MAX, 0);
+    }
+    return pdPASS;
+}
+
+static inline UBaseType_t usr_queue_messages_waiting(usr_queue_t *queue)
+{
+    return __atomic_load_n(&queue->count, __ATOMIC_RELAXED);
+}
+#endif
+
+#if CONFIG_ESP_SYSCALL_USER_SEMAPHORES
+/*
+ * Semaphores and mutexes created by user app are kept in user app memory. The futex word of a
+ * semaphore is its count, tasks blocked on it are counted in waiters so that a give only enters
+ * protected app when one has to be woken up. The futex word of a mutex is the user task handle of
+ * its holder, taken and released with a single compare and swap. A task which finds it held blocks
+ * with ESP_FUTEX_LOCK_PI, which lends its priority to the holder and sets ESP_FUTEX_WAITERS, so that
+ * the holder then releases it with ESP_FUTEX_UNLOCK_PI.
+ */
+#define USR_SEM_MAGIC           0x554d4553      // "SEMU"
+#define USR_TASK_SELF_SLOTS     16
+
+typedef struct {
+    uint32_t magic;
+    uint32_t type;                      // queueQUEUE_TYPE_* given at creation
+    volatile uint32_t futex;            // Count of a semaphore, holder of a mutex
+    volatile uint32_t waiters;          // Tasks blocked on a semaphore
+    uint32_t max_count;                 // Maximum count of a semaphore
+    uint32_t recursion;                 // Recursion depth of a mutex, only accessed by its holder
+} usr_sem_t;
+
+/*
+ * User task handle of the tasks which took a mutex, by thread pointer, so that a task only makes
+ * a system call to get its handle once. A thread pointer is reused once the stack of a deleted
+ * task is freed, so the cache is cleared by usr_mem_cleanup_task before it frees one.
+ */
+typedef struct {
+    volatile uint32_t tp;
+    volatile uint32_t handle;
+} usr_task_self_t;
+
+static usr_task_self_t usr_task_self_cache[USR_TASK_SELF_SLOTS];
+
+static uint32_t usr_task_self(void)
+{
+    uint32_t tp = usr_lock_self();
+    uint32_t slot = (tp >> 4) % USR_TASK_SELF_SLOTS;
+
+    for (int i = 0; i < USR_TASK_SELF_SLOTS; i++) {
+        usr_task_self_t *entry = &usr_task_self_cache[(slot + i) % USR_TASK_SELF_SLOTS];
+        uint32_t key = __atomic_load_n(&entry->tp, __ATOMIC_RELAXED);
+        if (key == tp && entry->handle) {
+            return entry->handle;
+        }
+        if (key == 0) {
+            break;
+        }
+    }
+
+    uint32_t self = (uint32_t)xTaskGetCurrentTaskHandle();
+    for (int i = 0; i < USR_TASK_SELF_SLOTS; i++) {
+        usr_task_self_t *entry = &usr_task_self_cache[(slot + i) % USR_TASK_SELF_SLOTS];
+        uint32_t key = 0;
+        if (__atomic_load_n(&entry->tp, __ATOMIC_RELAXED) == tp ||
+                __atomic_compare_exchange_n(&entry->tp, &key, tp, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            entry->handle = self;
+            break;
+        }
+    }
+    /* Not cached when all the slots are used, the next call makes a system call again */
+    return self;
+}
+
+void usr_task_self_cache_clear(void)
+{
+    for (int i = 0; i < USR_TASK_SELF_SLOTS; i++) {
+        usr_task_self_cache[i].handle = 0;
+        __atomic_store_n(&usr_task_self_cache[i].tp, 0, __ATOMIC_RELEASE);
+    }
+}
+
+static inline bool usr_sem_is_mutex(usr_sem_t *sem)
+{
+    return sem->type == queueQUEUE_TYPE_MUTEX || sem->type == queueQUEUE_TYPE_RECURSIVE_MUTEX;
+}
+
+static inline usr_sem_t *usr_sem_get(QueueHandle_t xSemaphore)
+{
+    usr_sem_t *sem = (usr_sem_t *)xSemaphore;
+
+    if (!usr_obj_is_valid(sem, sizeof(usr_sem_t)) || sem->magic != USR_SEM_MAGIC) {
+        return NULL;
+    }
+    return sem;
+}
+
+static QueueHandle_t usr_sem_create(uint8_t type, uint32_t max_count, uint32_t initial_count)
+{
+    if (max_count == 0 || initial_count > max_count) {
+        return NULL;
+    }
+    usr_sem_t *sem = calloc(1, sizeof(usr_sem_t));
+    if (sem == NULL) {
+        return NULL;
+    }
+    sem->type = type;
+    sem->max_count = max_count;
+    sem->futex = initial_count;
+    sem->magic = USR_SEM_MAGIC;
+    return (QueueHandle_t)sem;
+}
+
+static void usr_sem_delete(usr_sem_t *sem)
+{
+    sem->magic = 0;
+    free(sem);
+}
+
+static BaseType_t usr_mutex_take(usr_sem_t *sem, TickType_t timeout, bool recursive)
+{
+    uint32_t self = usr_task_self();
+    uint32_t owner = 0;
+
+    if (recursive && (__atomic_load_n(&sem->futex, __ATOMIC_RELAXED) & ~ESP_FUTEX_WAITERS) == self) {
+        sem->recursion++;
+        return pdTRUE;
+    }
+    if (!__atomic_compare_exchange_n(&sem->futex, &owner, self, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        /* A free mutex with ESP_FUTEX_WAITERS set is handed over by protected app */
+        if (timeout == 0 && (owner & ~ESP_FUTEX_WAITERS) != 0) {
+            return pdFALSE;
+        }
+        if (__usr_esp_futex(&sem->futex, ESP_FUTEX_LOCK_PI, 0, timeout) != 0) {
+            return pdFALSE;
+        }
+    }
+    sem->recursion = 1;
+    return pdTRUE;
+}
+
+static BaseType_t usr_mutex_give(usr_sem_t *sem)
+{
+    uint32_t self = usr_task_self();
+    uint32_t owner = self;
+
+    if ((__atomic_load_n(&sem->futex, __ATOMIC_RELAXED) & ~ESP_FUTEX_WAITERS) != self) {
+        return pdFAIL;
+    }
+    if (--sem->recursion) {
+        return pdTRUE;
+    }
+    if (!__atomic_compare_exchange_n(&sem->futex, &owner, 0, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        /* ESP_FUTEX_WAITERS is set, let protected app wake up a blocked task and drop the inherited priority */
+        __usr_esp_futex(&sem->futex, ESP_FUTEX_UNLOCK_PI, 0, 0);
+    }
+    return pdTRUE;
+}
+
+static BaseType_t usr_sem_take(usr_sem_t *sem, TickType_t timeout)
+{
+    uint32_t count = __atomic_load_n(&sem->futex, __ATOMIC_RELAXED);
+    TickType_t start = 0;
+    bool blocked = false;
+
+    if (usr_sem_is_mutex(sem)) {
+        return usr_mutex_take(sem, timeout, false);
+    }
+    while (1) {
+        while (count != 0) {
+            if (__atomic_compare_exchange_n(&sem->futex, &count, count - 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                return pdTRUE;
+            }
+        }
+        if (timeout == 0) {
+            return pdFALSE;
+        }
+        if (!blocked) {
+            start = xTaskGetTickCount();
+            blocked = true;
+        }
+        TickType_t remaining = usr_ticks_remaining(start, timeout);
+        if (remaining == 0) {
+            return pdFALSE;
+        }
+        /* Counted before the count is checked again in protected app, so a give after it wakes this task up */
+        __atomic_fetch_add(&sem->waiters, 1, __ATOMIC_SEQ_CST);
+        __usr_esp_futex(&sem->futex, ESP_FUTEX_WAIT, 0, remaining);
+        __atomic_fetch_sub(&sem->waiters, 1, __ATOMIC_RELAXED);
+        count = __atomic_load_n(&sem->futex, __ATOMIC_RELAXED);
+    }
+}
+
+/*
+ * With from_isr, the give never blocks: a mutex cannot be given, as with FreeRTOS, and a task woken up is
+ * not scheduled by the esp_futex system call but reported in task_woken, so that the caller yields.
+ */
+static BaseType_t usr_sem_give(usr_sem_t *sem, bool from_isr, BaseType_t *task_woken)
+{
+    uint32_t count = __atomic_load_n(&sem->futex, __ATOMIC_RELAXED);
+
+    if (usr_sem_is_mutex(sem)) {
+        return from_isr ? pdFAIL : usr_mutex_give(sem);
+    }
+    do {
+        if (count >= sem->max_count) {
+            return errQUEUE_FULL;
+        }
+    } while (!__atomic_compare_exchange_n(&sem->futex, &count, count + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+
+    if (__atomic_load_n(&sem->waiters, __ATOMIC_SEQ_CST)) {
+        if (!from_isr) {
+            __usr_esp_futex(&sem->futex, ESP_FUTEX_WAKE, 1, 0);
+        } else if (__usr_esp_futex(&sem->futex, ESP_FUTEX_WAKE_FROM_ISR, 1, 0) == pdTRUE && task_woken) {
+            *task_woken = pdTRUE;
+        }
+    }
+    return pdTRUE;
+}
+
+static UBaseType_t usr_sem_get_count(usr_sem_t *sem)
+{
+    uint32_t val = __atomic_load_n(&sem->futex, __ATOMIC_RELAXED);
+
+    if (usr_sem_is_mutex(sem)) {
+        return (val & ~ESP_FUTEX_WAITERS) ? 0 : 1;
+    }
+    return val;
+}
+#endif
+
 // Queue Management
 QueueHandle_t usr_xQueueGenericCreate(uint32_t QueueLength, uint32_t ItemSize, uint8_t ucQueueType)
 {
+#if CONFIG_ESP_SYSCALL_USER_QUEUES
+    if (ucQueueType == queueQUEUE_TYPE_BASE && ItemSize != 0) {
+        return usr_queue_create(QueueLength, ItemSize);
+    }
+#endif
+#if CONFIG_ESP_SYSCALL_USER_SEMAPHORES
+    if (ucQueueType == queueQUEUE_TYPE_BINARY_SEMAPHORE) {
+        return usr_sem_create(ucQueueType, 1, 0);
+    }
+#endif
     return EXECUTE_SYSCALL(QueueLength, ItemSize, ucQueueType, __NR_xQueueGenericCreate);
 }
 
 void usr_vQueueDelete(QueueHandle_t xQueue)
 {
+#if CONFIG_ESP_SYSCALL_USER_QUEUES
+    usr_queue_t *queue = usr_queue_get(xQueue);
+    if (queue) {
+        usr_queue_delete(queue);
+        return;
+    }
+#endif
+#if CONFIG_ESP_SYSCALL_USER_SEMAPHORES
+    usr_sem_t *sem = usr_sem_get(xQueue);
+    if (sem) {
+        usr_sem_delete(sem);
+        return;
+    }
+#endif
     EXECUTE_SYSCALL(xQueue, __NR_vQueueDelete);
 }
 
 BaseType_t usr_xQueueGenericSend(QueueHandle_t xQueue, const void * const pvItemToQueue, TickType_t xTicksToWait, const BaseType_t xCopyPosition)
 {
+#if CONFIG_ESP_SYSCALL_USER_QUEUES
+    usr_queue_t *queue = usr_queue_get(xQueue);
+    if (queue) {
+        return usr_queue_send(queue, pvItemToQueue, xTicksToWait, xCopyPosition, false, NULL);
+    }
+#endif
+#if CONFIG_ESP_SYSCALL_USER_SEMAPHORES
+    usr_sem_t *sem = usr_sem_get(xQueue);
+    if (sem) {
+        return usr_sem_give(sem, false, NULL);
+    }
+#endif
     return EXECUTE_SYSCALL(xQueue, pvItemToQueue, xTicksToWait, xCopyPosition, __NR_xQueueGenericSend);
 }
 
 BaseType_t usr_xQueueGenericSendFromISR(QueueHandle_t xQueue, const void * const pvItemToQueue, BaseType_t * const pxHigherPriorityTaskWoken, const BaseType_t xCopyPosition)
 {
+#if CONFIG_ESP_SYSCALL_USER_QUEUES
+    usr_queue_t *queue = usr_queue_get(xQueue);
+    if (queue) {
+        return usr_queue_send(queue, pvItemToQueue, 0, xCopyPosition, true, pxHigherPriorityTaskWoken);
+    }
+#endif
     return EXECUTE_SYSCALL(xQueue, pvItemToQueue, pxHigherPriorityTaskWoken, xCopyPosition, __NR_xQueueGenericSendFromISR);
 }
 
 BaseType_t usr_xQueueReceive(QueueHandle_t xQueue, void * const buffer, TickType_t TickstoWait)
 {
+#if CONFIG_ESP_SYSCALL_USER_QUEUES
+    usr_queue_t *queue = usr_queue_get(xQueue);
+    if (queue) {
+        return usr_queue_receive(queue, buffer, TickstoWait, false, false, NULL);
+    }
+#endif
     return EXECUTE_SYSCALL(xQueue, buffer, TickstoWait, __NR_xQueueReceive);
 }
 
 BaseType_t usr_xQueueReceiveFromISR(QueueHandle_t xQueue, void * const pvBuffer, BaseType_t * const pxHigherPriorityTaskWoken)
 {
+#if CONFIG_ESP_SYSCALL_USER_QUEUES
+    usr_queue_t *queue = usr_queue_get(xQueue);
+    if (queue) {
+        return usr_queue_receive(queue, pvBuffer, 0, false, true, pxHigherPriorityTaskWoken);
+    }
+#endif
     return EXECUTE_SYSCALL(xQueue, pvBuffer, pxHigherPriorityTaskWoken, __NR_xQueueReceiveFromISR);
 }
 
 UBaseType_t usr_uxQueueMessagesWaiting(const QueueHandle_t xQueue)
 {
+#if CONFIG_ESP_SYSCALL_USER_QUEUES
+    usr_queue_t *queue = usr_queue_get(xQueue);
+    if (queue) {
+        return usr_queue_messages_waiting(queue);
+    }
+#endif
+#if CONFIG_ESP_SYSCALL_USER_SEMAPHORES
+    usr_sem_t *sem = usr_sem_get(xQueue);
+    if (sem) {
+        return usr_sem_get_count(sem);
+    }
+#endif
     return EXECUTE_SYSCALL(xQueue, __NR_uxQueueMessagesWaiting);
 }
 
 UBaseType_t usr_uxQueueMessagesWaitingFromISR(const QueueHandle_t xQueue)
 {
+#if CONFIG_ESP_SYSCALL_USER_QUEUES
+    usr_queue_t *queue = usr_queue_get(xQueue);
+    if (queue) {
+        return usr_queue_messages_waiting(queue);
+    }
+#endif
+#if CONFIG_ESP_SYSCALL_USER_SEMAPHORES
+    usr_sem_t *sem = usr_sem_get(xQueue);
+    if (sem) {
+        return usr_sem_get_count(sem);
+    }
+#endif
     return EXECUTE_SYSCALL(xQueue, __NR_uxQueueMessagesWaitingFromISR);
 }
 
 UBaseType_t usr_uxQueueSpacesAvailable(const QueueHandle_t xQueue)
 {
+#if CONFIG_ESP_SYSCALL_USER_QUEUES
+    usr_queue_t *queue = usr_queue_get(xQueue);
+    if (queue) {
+        return queue->length - usr_queue_messages_waiting(queue);
+    }
+#endif
     return EXECUTE_SYSCALL(xQueue, __NR_uxQueueSpacesAvailable);
 }
 
 BaseType_t usr_xQueueGenericReset(QueueHandle_t xQueue, BaseType_t xNewQueue)
 {
+#if CONFIG_ESP_SYSCALL_USER_QUEUES
+    usr_queue_t *queue = usr_queue_get(xQueue);
+    if (queue) {
+        return usr_queue_reset(queue);
+    }
+#endif
     return EXECUTE_SYSCALL(xQueue, xNewQueue, __NR_xQueueGenericReset);
 }
 
 BaseType_t usr_xQueuePeek(QueueHandle_t xQueue, void * const pvBuffer, TickType_t xTicksToWait)
 {
+#if CONFIG_ESP_SYSCALL_USER_QUEUES
+    usr_queue_t *queue = usr_queue_get(xQueue);
+    if (queue) {
+        return usr_queue_receive(queue, pvBuffer, xTicksToWait, true, false, NULL);
+    }
+#endif
     return EXECUTE_SYSCALL(xQueue, pvBuffer, xTicksToWait, __NR_xQueuePeek);
 }
 
 BaseType_t usr_xQueuePeekFromISR(QueueHandle_t xQueue,  void * const pvBuffer)
 {
+#if CONFIG_ESP_SYSCALL_USER_QUEUES
+    usr_queue_t *queue = usr_queue_get(xQueue);
+    if (queue) {
+        return usr_queue_receive(queue, pvBuffer, 0, true, true, NULL);
+    }
+#endif
     return EXECUTE_SYSCALL(xQueue, pvBuffer, __NR_xQueuePeekFromISR);
 }
 
 BaseType_t usr_xQueueIsQueueEmptyFromISR(const QueueHandle_t xQueue)
 {
+#if CONFIG_ESP_SYSCALL_USER_QUEUES
+    usr_queue_t *queue = usr_queue_get(xQueue);
+    if (queue) {
+        return usr_queue_messages_waiting(queue) == 0 ? pdTRUE : pdFALSE;
+    }
+#endif
     return EXECUTE_SYSCALL(xQueue, __NR_xQueueIsQueueEmptyFromISR);
 }
 
 BaseType_t usr_xQueueIsQueueFullFromISR(const QueueHandle_t xQueue)
 {
+#if CONFIG_ESP_SYSCALL_USER_QUEUES
+    usr_queue_t *queue = usr_queue_get(xQueue);
+    if (queue) {
+        return usr_queue_messages_waiting(queue) == queue->length ? pdTRUE : pdFALSE;
+    }
+#endif
     return EXECUTE_SYSCALL(xQueue, __NR_xQueueIsQueueFullFromISR);
 }
 
@@ -513,11 +1436,33 @@ QueueSetHandle_t usr_xQueueCreateSet(const UBaseType_t uxEventQueueLength)
 
 BaseType_t usr_xQueueAddToSet(QueueSetMemberHandle_t xQueueOrSemaphore, QueueSetHandle_t xQueueSet)
 {
+#if CONFIG_ESP_SYSCALL_USER_QUEUES
+    /* Queue sets are in protected app, they cannot be notified of the items added to a user app queue */
+    if (usr_queue_get((QueueHandle_t)xQueueOrSemaphore)) {
+        return pdFAIL;
+    }
+#endif
+#if CONFIG_ESP_SYSCALL_USER_SEMAPHORES
+    if (usr_sem_get((QueueHandle_t)xQueueOrSemaphore)) {
+        return pdFAIL;
+    }
+#endif
     return EXECUTE_SYSCALL(xQueueOrSemaphore, xQueueSet, __NR_xQueueAddToSet);
 }
 
 BaseType_t usr_xQueueRemoveFromSet(QueueSetMemberHandle_t xQueueOrSemaphore, QueueSetHandle_t xQueueSet)
 {
+#if CONFIG_ESP_SYSCALL_USER_QUEUES
+    /* Queue sets are in protected app, they cannot be notified of the items added to a user app queue */
+    if (usr_queue_get((QueueHandle_t)xQueueOrSemaphore)) {
+        return pdFAIL;
+    }
+#endif
+#if CONFIG_ESP_SYSCALL_USER_SEMAPHORES
+    if (usr_sem_get((QueueHandle_t)xQueueOrSemaphore)) {
+        return pdFAIL;
+    }
+#endif
     return EXECUTE_SYSCALL(xQueueOrSemaphore, xQueueSet, __NR_xQueueRemoveFromSet);
 }
 
@@ -534,36 +1479,74 @@ QueueSetMemberHandle_t usr_xQueueSelectFromSetFromISR(QueueSetHandle_t xQueueSet
 // Semaphore
 QueueHandle_t usr_xQueueCreateCountingSemaphore(const UBaseType_t uxMaxCount, const UBaseType_t uxInitialCount)
 {
+#if CONFIG_ESP_SYSCALL_USER_SEMAPHORES
+    return usr_sem_create(queueQUEUE_TYPE_COUNTING_SEMAPHORE, uxMaxCount, uxInitialCount);
+#else
     return EXECUTE_SYSCALL(uxMaxCount, uxInitialCount, __NR_xQueueCreateCountingSemaphore);
+#endif
 }
 
 QueueHandle_t usr_xQueueCreateMutex(const uint8_t ucQueueType)
 {
+#if CONFIG_ESP_SYSCALL_USER_SEMAPHORES
+    return usr_sem_create(ucQueueType, 1, 0);
+#else
     return EXECUTE_SYSCALL(ucQueueType, __NR_xQueueCreateMutex);
+#endif
 }
 
 TaskHandle_t usr_xQueueGetMutexHolder(QueueHandle_t xSemaphore)
 {
+#if CONFIG_ESP_SYSCALL_USER_SEMAPHORES
+    usr_sem_t *sem = usr_sem_get(xSemaphore);
+    if (sem) {
+        return usr_sem_is_mutex(sem) ? (TaskHandle_t)(sem->futex & ~ESP_FUTEX_WAITERS) : NULL;
+    }
+#endif
     return EXECUTE_SYSCALL(xSemaphore, __NR_xQueueGetMutexHolder);
 }
 
 BaseType_t usr_xQueueSemaphoreTake(QueueHandle_t xQueue, TickType_t xTicksToWait)
 {
+#if CONFIG_ESP_SYSCALL_USER_SEMAPHORES
+    usr_sem_t *sem = usr_sem_get(xQueue);
+    if (sem) {
+        return usr_sem_take(sem, xTicksToWait);
+    }
+#endif
     return EXECUTE_SYSCALL(xQueue, xTicksToWait, __NR_xQueueSemaphoreTake);
 }
 
 BaseType_t usr_xQueueTakeMutexRecursive(QueueHandle_t xMutex, TickType_t xTicksToWait)
 {
+#if CONFIG_ESP_SYSCALL_USER_SEMAPHORES
+    usr_sem_t *sem = usr_sem_get(xMutex);
+    if (sem) {
+        return usr_mutex_take(sem, xTicksToWait, true);
+    }
+#endif
     return EXECUTE_SYSCALL(xMutex, xTicksToWait, __NR_xQueueTakeMutexRecursive);
 }
 
 BaseType_t usr_xQueueGiveMutexRecursive(QueueHandle_t xMutex)
 {
+#if CONFIG_ESP_SYSCALL_USER_SEMAPHORES
+    usr_sem_t *sem = usr_sem_get(xMutex);
+    if (sem) {
+        return usr_mutex_give(sem);
+    }
+#endif
     return EXECUTE_SYSCALL(xMutex, __NR_xQueueGiveMutexRecursive);
 }
 
 BaseType_t usr_xQueueGiveFromISR(QueueHandle_t xQueue, BaseType_t * const pxHigherPriorityTaskWoken)
 {
+#if CONFIG_ESP_SYSCALL_USER_SEMAPHORES
+    usr_sem_t *sem = usr_sem_get(xQueue);
+    if (sem) {
+        return usr_sem_give(sem, true, pxHigherPriorityTaskWoken);
+    }
+#endif
     return EXECUTE_SYSCALL(xQueue, pxHigherPriorityTaskWoken, __NR_xQueueGiveFromISR);
 }
 
@@ -748,24 +1731,83 @@ ssize_t usr_lwip_sendto(int s, const void *data, size_t size, int flags, const s
     return EXECUTE_SYSCALL(s, data, size, flags, to, tolen, __NR_lwip_sendto);
 }
 
+/*
+ * lwip_inet_ntop, lwip_inet_pton, lwip_htonl and lwip_htons are marked "user" in syscall.tbl,
+ * they do not need any privilege and are implemented here without a system call.
+ * IPv6 addresses and IPv4 addresses not in canonical dotted decimal form still go through
+ * the system call, so that lwIP parses and formats them.
+ */
 const char *usr_lwip_inet_ntop(int af, const void *src, char *dst, socklen_t size)
 {
-    return EXECUTE_SYSCALL(af, src, dst, size, __NR_lwip_inet_ntop);
+    const uint8_t *addr = src;
+    char buf[sizeof("255.255.255.255")];
+    char *p = buf;
+
+    if (af != AF_INET) {
+        return EXECUTE_SYSCALL(af, src, dst, size, __NR_lwip_inet_ntop);
+    }
+
+    for (int i = 0; i < 4; i++) {
+        if (addr[i] >= 100) {
+            *p++ = '0' + addr[i] / 100;
+        }
+        if (addr[i] >= 10) {
+            *p++ = '0' + (addr[i] / 10) % 10;
+        }
+        *p++ = '0' + addr[i] % 10;
+        *p++ = (i < 3) ? '.' : '\0';
+    }
+    if ((socklen_t)(p - buf) > size) {
+        errno = ENOSPC;
+        return NULL;
+    }
+    memcpy(dst, buf, p - buf);
+    return dst;
 }
 
 int usr_lwip_inet_pton(int af, const char *src, void *dst)
 {
-    return EXECUTE_SYSCALL(af, src, dst, __NR_lwip_inet_pton);
+    uint8_t addr[4];
+    const char *p = src;
+    int i;
+
+    if (af != AF_INET) {
+        return EXECUTE_SYSCALL(af, src, dst, __NR_lwip_inet_pton);
+    }
+
+    for (i = 0; i < 4; i++) {
+        int digits = 0;
+        uint32_t value = 0;
+
+        while (*p >= '0' && *p <= '9' && digits < 4) {
+            value = value * 10 + (*p++ - '0');
+            digits++;
+        }
+        /* lwIP also accepts octal, hexadecimal and shorthand forms, leave these to it */
+        if (digits == 0 || digits > 3 || value > 255 || (digits > 1 && p[-digits] == '0')) {
+            break;
+        }
+        addr[i] = value;
+        if (*p != ((i < 3) ? '.' : '\0')) {
+            break;
+        }
+        p++;
+    }
+    if (i < 4) {
+        return EXECUTE_SYSCALL(af, src, dst, __NR_lwip_inet_pton);
+    }
+    memcpy(dst, addr, sizeof(addr));
+    return 1;
 }
 
 u32_t usr_lwip_htonl(u32_t n)
 {
-    return EXECUTE_SYSCALL(n, __NR_lwip_htonl);
+    return __builtin_bswap32(n);
 }
 
 u16_t usr_lwip_htons(u16_t n)
 {
-    return EXECUTE_SYSCALL(n, __NR_lwip_htons);
+    return __builtin_bswap16(n);
 }
 
 int *usr___errno(void)
@@ -912,48 +1954,59 @@ void usr_esp_fill_random(void *buf, size_t len)
 
 esp_err_t usr_esp_timer_create(const esp_timer_create_args_t* create_args, esp_timer_handle_t* out_handle)
 {
-    return EXECUTE_SYSCALL(create_args, out_handle, __NR_esp_timer_create);
+    return __usr_esp_timer_create(create_args, out_handle);
 }
 
 esp_err_t usr_esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
 {
-    return EXECUTE_SYSCALL(timer, timeout_us, __NR_esp_timer_start_once);
+    return __usr_esp_timer_start_once(timer, timeout_us);
 }
 
 esp_err_t usr_esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period)
 {
-    return EXECUTE_SYSCALL(timer, period, __NR_esp_timer_start_periodic);
+    return __usr_esp_timer_start_periodic(timer, period);
 }
 
 esp_err_t usr_esp_timer_stop(esp_timer_handle_t timer)
 {
-    return EXECUTE_SYSCALL(timer, __NR_esp_timer_stop);
+    return __usr_esp_timer_stop(timer);
 }
 
 esp_err_t usr_esp_timer_delete(esp_timer_handle_t timer)
 {
-    esp_err_t err = EXECUTE_SYSCALL(timer, __NR_esp_timer_delete);
-    return err;
+    return __usr_esp_timer_delete(timer);
 }
 
 UIRAM_ATTR int64_t usr_esp_timer_get_time(void)
 {
-    return EXECUTE_SYSCALL(__NR_esp_timer_get_time);
+#if CONFIG_ESP_SYSCALL_VDSO
+    int64_t time_us;
+    if (usr_vdso_get_time(&time_us)) {
+        return time_us;
+    }
+#endif
+    return __usr_esp_timer_get_time();
 }
 
 UIRAM_ATTR int64_t usr_esp_timer_get_next_alarm(void)
 {
-    return EXECUTE_SYSCALL(__NR_esp_timer_get_next_alarm);
+    return __usr_esp_timer_get_next_alarm();
 }
 
 bool usr_esp_timer_is_active(esp_timer_handle_t timer)
 {
-    return EXECUTE_SYSCALL(timer, __NR_esp_timer_is_active);
+    return __usr_esp_timer_is_active(timer);
 }
 
 int64_t UIRAM_ATTR usr_esp_system_get_time(void)
 {
-    return EXECUTE_SYSCALL(__NR_esp_system_get_time);
+#if CONFIG_ESP_SYSCALL_VDSO
+    int64_t time_us;
+    if (usr_vdso_get_time(&time_us)) {
+        return time_us + usr_vdso_data.boot_time_offset_us;
+    }
+#endif
+    return __usr_esp_system_get_time();
 }
 
 esp_err_t usr_uart_driver_install(uart_port_t uart_num, int rx_buffer_size, int tx_buffer_size, int queue_size, QueueHandle_t* uart_queue, int intr_alloc_flags)
@@ -981,6 +2034,69 @@ esp_err_t usr_esp_get_protected_heap_stats(protected_heap_stats_t *stats)
     return EXECUTE_SYSCALL(stats, __NR_esp_get_protected_heap_stats);
 }
 
+esp_err_t usr_esp_map_get_stats(esp_map_stats_t *stats)
+{
+    return __usr_esp_map_get_stats(stats);
+}
+
+esp_err_t usr_esp_syscall_trace_get_stats(uint32_t index, esp_syscall_trace_stats_t *stats)
+{
+    return __usr_esp_syscall_trace_get_stats(index, stats);
+}
+
+int usr_esp_syscall_trace_get_records(esp_syscall_trace_record_t *records, uint32_t max_records)
+{
+    return __usr_esp_syscall_trace_get_records(records, max_records);
+}
+
+#if CONFIG_ESP_SYSCALL_RING
+void usr_esp_syscall_ring_init(esp_syscall_ring_t *ring)
+{
+    memset(ring, 0, sizeof(esp_syscall_ring_t));
+}
+
+esp_syscall_sqe_t *usr_esp_syscall_ring_get_sqe(esp_syscall_ring_t *ring)
+{
+    uint32_t sq_tail = ring->sq_tail;
+    if (sq_tail - ring->sq_head == ESP_SYSCALL_RING_ENTRIES) {
+        return NULL;
+    }
+    return &ring->sq[sq_tail & (ESP_SYSCALL_RING_ENTRIES - 1)];
+}
+
+void usr_esp_syscall_ring_submit(esp_syscall_ring_t *ring)
+{
+    /* The submission must be visible before protected app sees the new tail */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    ring->sq_tail++;
+}
+
+int usr_esp_syscall_ring_enter(esp_syscall_ring_t *ring, uint32_t to_submit)
+{
+    return __usr_esp_syscall_ring_enter(ring, to_submit);
+}
+
+int usr_esp_futex(volatile uint32_t *uaddr, int op, uint32_t val, TickType_t timeout)
+{
+    return __usr_esp_futex(uaddr, op, val, timeout);
+}
+
+esp_syscall_cqe_t *usr_esp_syscall_ring_peek_cqe(esp_syscall_ring_t *ring)
+{
+    uint32_t cq_head = ring->cq_head;
+    if (cq_head == ring->cq_tail) {
+        return NULL;
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return &ring->cq[cq_head & (ESP_SYSCALL_RING_ENTRIES - 1)];
+}
+
+void usr_esp_syscall_ring_cqe_seen(esp_syscall_ring_t *ring)
+{
+    ring->cq_head++;
+}
+#endif
+
 esp_err_t usr_esp_user_ota_cancel_rollback(void)
 {
     return EXECUTE_SYSCALL(__NR_esp_user_ota_cancel_rollback);
@@ -1006,58 +2122,416 @@ void usr_lwip_freeaddrinfo(struct addrinfo *ai)
     free(ai);
 }
 
-int usr_vprintf(const char * fmt, va_list ap)
+/*
+ * Log lines are formatted in a buffer on the stack of the calling task, so that printf does not
+ * use the heap and also works before the heap is initialized. A line that does not fit in the
+ * buffer is formatted again one conversion at a time with snprintf, and the buffer is written
+ * out whenever the next piece does not fit. Strings are copied in chunks and can have any length,
+ * other conversions longer than the buffer are truncated.
+ */
+#define USR_LOG_LINE_BUF_SIZE   256
+
+typedef int (*usr_log_write_t)(const char *str, size_t len);
+
+typedef struct {
+    char buf[USR_LOG_LINE_BUF_SIZE];
+    size_t len;
+    int total;
+    bool failed;
+    usr_log_write_t write;
+} usr_log_chunk_t;
+
+static void usr_log_chunk_flush(usr_log_chunk_t *chunk)
 {
+    if (chunk->len > 0 && !chunk->failed) {
+        chunk->buf[chunk->len] = '\0';
+        chunk->failed = chunk->write(chunk->buf, chunk->len) < 0;
+    }
+    chunk->len = 0;
+}
+
+static void usr_log_chunk_put(usr_log_chunk_t *chunk, const char *str, size_t len)
+{
+    chunk->total += len;
+    while (len > 0) {
+        /* One byte is kept for the NULL terminator */
+        size_t n = MIN(len, sizeof(chunk->buf) - 1 - chunk->len);
+        memcpy(chunk->buf + chunk->len, str, n);
+        chunk->len += n;
+        str += n;
+        len -= n;
+        if (chunk->len == sizeof(chunk->buf) - 1) {
+            usr_log_chunk_flush(chunk);
+        }
+    }
+}
+
+/* Format a single conversion, spec holds its flags, width, precision and length modifier */
+static void usr_log_chunk_format(usr_log_chunk_t *chunk, const char *spec, ...)
+{
+    va_list ap, ap_copy;
+    size_t space = sizeof(chunk->buf) - chunk->len;
     int ret;
-    char *str_ptr = NULL;
-    ret = vasprintf(&str_ptr, fmt, ap);
-    assert(str_ptr != NULL);
-    ret = usr_write_log_line(str_ptr, ret);
-    free(str_ptr);
-    return ret;
+
+    va_start(ap, spec);
+    va_copy(ap_copy, ap);
+    ret = vsnprintf(chunk->buf + chunk->len, space, spec, ap);
+    if (ret >= 0 && (size_t)ret >= space && chunk->len > 0) {
+        usr_log_chunk_flush(chunk);
+        space = sizeof(chunk->buf);
+        ret = vsnprintf(chunk->buf, space, spec, ap_copy);
+    }
+    va_end(ap_copy);
+    va_end(ap);
+
+    if (ret < 0) {
+        chunk->failed = true;
+        return;
+    }
+    chunk->total += ret;
+    chunk->len += MIN((size_t)ret, space - 1);
+    if (chunk->len == sizeof(chunk->buf) - 1) {
+        usr_log_chunk_flush(chunk);
+    }
+}
+
+static void usr_log_chunk_vprintf(usr_log_chunk_t *chunk, const char *fmt, va_list *ap)
+{
+    char spec[32];
+
+    while (*fmt) {
+        const char *p = fmt + strcspn(fmt, "%");
+        usr_log_chunk_put(chunk, fmt, p - fmt);
+        if (*p == '\0') {
+            break;
+        }
+
+        /* Copy the conversion specification, '*' is replaced by the value of its argument */
+        size_t n = 0;
+        spec[n++] = *p++;
+        while (*p && strchr("-+ #0123456789.*hlLjztq", *p)) {
+            if (*p == '*') {
+                n += snprintf(spec + n, sizeof(spec) - n, "%d", va_arg(*ap, int));
+            } else if (n < sizeof(spec) - 1) {
+                spec[n++] = *p;
+            }
+            n = MIN(n, sizeof(spec) - 2);
+            p++;
+        }
+        if (*p == '\0') {
+            break;
+        }
+        char conv = *p++;
+        fmt = p;
+        spec[n++] = conv;
+        spec[n] = '\0';
+
+        const char *len = spec + strcspn(spec, "hlLjztq");
+        bool is_ll = (len[0] == 'l' && len[1] == 'l') || len[0] == 'q';
+
+        switch (conv) {
+        case 'd': case 'i':
+            if (is_ll) {
+                usr_log_chunk_format(chunk, spec, va_arg(*ap, long long));
+            } else if (len[0] == 'l') {
+                usr_log_chunk_format(chunk, spec, va_arg(*ap, long));
+            } else if (len[0] == 'j') {
+                usr_log_chunk_format(chunk, spec, va_arg(*ap, intmax_t));
+            } else if (len[0] == 'z') {
+                usr_log_chunk_format(chunk, spec, va_arg(*ap, ssize_t));
+            } else if (len[0] == 't') {
+                usr_log_chunk_format(chunk, spec, va_arg(*ap, ptrdiff_t));
+            } else {
+                usr_log_chunk_format(chunk, spec, va_arg(*ap, int));
+            }
+            break;
+        case 'u': case 'o': case 'x': case 'X':
+            if (is_ll) {
+                usr_log_chunk_format(chunk, spec, va_arg(*ap, unsigned long long));
+            } else if (len[0] == 'l') {
+                usr_log_chunk_format(chunk, spec, va_arg(*ap, unsigned long));
+            } else if (len[0] == 'j') {
+                usr_log_chunk_format(chunk, spec, va_arg(*ap, uintmax_t));
+            } else if (len[0] == 'z') {
+                usr_log_chunk_format(chunk, spec, va_arg(*ap, size_t));
+            } else if (len[0] == 't') {
+                usr_log_chunk_format(chunk, spec, va_arg(*ap, ptrdiff_t));
+            } else {
+                usr_log_chunk_format(chunk, spec, va_arg(*ap, unsigned int));
+            }
+            break;
+        case 'c':
+            usr_log_chunk_format(chunk, spec, va_arg(*ap, int));
+            break;
+        case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+            if (len[0] == 'L') {
+                usr_log_chunk_format(chunk, spec, va_arg(*ap, long double));
+            } else {
+                usr_log_chunk_format(chunk, spec, va_arg(*ap, double));
+            }
+            break;
+        case 'p':
+            usr_log_chunk_format(chunk, spec, va_arg(*ap, void *));
+            break;
+        case 's': {
+            const char *str = va_arg(*ap, const char *);
+            const char *field = spec + 1 + strspn(spec + 1, "-+ #0");
+            bool left = memchr(spec + 1, '-', field - spec - 1) != NULL;
+            size_t width = strtoul(field, (char **)&field, 10);
+            size_t str_len;
+            str = str ? str : "(null)";
+            /* The string may not be terminated within the precision */
+            str_len = (*field == '.') ? strnlen(str, strtoul(field + 1, NULL, 10)) : strlen(str);
+            for (size_t pad = str_len; !left && pad < width; pad++) {
+                usr_log_chunk_put(chunk, " ", 1);
+            }
+            usr_log_chunk_put(chunk, str, str_len);
+            for (size_t pad = str_len; left && pad < width; pad++) {
+                usr_log_chunk_put(chunk, " ", 1);
+            }
+            break;
+        }
+        case 'n': {
+            /* Only the plain int form is supported, the argument of other forms is skipped */
+            int *count = va_arg(*ap, int *);
+            if (n == 2) {
+                *count = chunk->total;
+            }
+            break;
+        }
+        case '%':
+            usr_log_chunk_put(chunk, "%", 1);
+            break;
+        default:
+            usr_log_chunk_put(chunk, spec, n);
+            break;
+        }
+    }
+}
+
+static int usr_log_vprintf(usr_log_write_t write, const char *fmt, va_list ap)
+{
+    usr_log_chunk_t chunk;
+    va_list ap_copy;
+    int ret;
+
+    va_copy(ap_copy, ap);
+    ret = vsnprintf(chunk.buf, sizeof(chunk.buf), fmt, ap_copy);
+    va_end(ap_copy);
+    if (ret < 0) {
+        return ret;
+    }
+    if ((size_t)ret < sizeof(chunk.buf)) {
+        return write(chunk.buf, ret) < 0 ? -1 : ret;
+    }
+
+    chunk.len = 0;
+    chunk.total = 0;
+    chunk.failed = false;
+    chunk.write = write;
+    va_copy(ap_copy, ap);
+    usr_log_chunk_vprintf(&chunk, fmt, &ap_copy);
+    va_end(ap_copy);
+    usr_log_chunk_flush(&chunk);
+    return chunk.failed ? -1 : chunk.total;
+}
+
+#if CONFIG_ESP_SYSCALL_USER_LOG_BINARY
+/*
+ * Binary log record, expanded on host by tools/esp_ps_log_decoder.py using user_app.elf:
+ *
+ *   0xFF 'L' | payload length (u16) | format offset (u32) | timestamp in ms (u32) | arguments
+ *
+ * The format offset is the offset of the format string from _user_rodata_start, so only
+ * formats placed in user app rodata can be sent as records. The arguments are stored in the
+ * order of the conversions of the format, little-endian: 4 bytes for integers, characters and
+ * pointers, 8 bytes for long long integers and floating point values, and a length byte followed
+ * by the characters for strings. Strings are truncated to 255 characters.
+ *
+ * The console may translate line endings, so every LF, CR or escape byte after the magic is
+ * sent as USR_LOG_BIN_ESC followed by the byte XORed with USR_LOG_BIN_ESC_XOR. The payload
+ * length counts the bytes before escaping.
+ */
+#define USR_LOG_BIN_MAGIC0      0xFF
+#define USR_LOG_BIN_MAGIC1      'L'
+#define USR_LOG_BIN_HDR_SIZE    12
+#define USR_LOG_BIN_ESC         0x7D
+#define USR_LOG_BIN_ESC_XOR     0x20
+
+#define USR_LOG_BIN_NEEDS_ESC(c)    ((c) == '\n' || (c) == '\r' || (c) == USR_LOG_BIN_ESC)
+
+extern int _user_rodata_start, _user_rodata_end;
+
+static inline bool usr_log_bin_put(uint8_t *buf, size_t size, size_t *pos, const void *val, size_t len)
+{
+    if (*pos + len > size) {
+        return false;
+    }
+    memcpy(&buf[*pos], val, len);
+    *pos += len;
+    return true;
+}
+
+/* Returns the length of the record, or -1 if the format cannot be encoded in buf */
+static int usr_log_bin_encode(uint8_t *buf, size_t size, const char *fmt, va_list ap)
+{
+    const char *p = fmt;
+    size_t pos = USR_LOG_BIN_HDR_SIZE;
+
+    while ((p = strchr(p, '%')) != NULL) {
+        int precision = -1;
+        int longs = 0;
+        bool long_double = false;
+        p++;
+        if (*p == '%') {
+            p++;
+            continue;
+        }
+        p += strspn(p, "-+ #0");
+        if (*p == '*') {
+            int width = va_arg(ap, int);
+            if (!usr_log_bin_put(buf, size, &pos, &width, sizeof(width))) {
+                return -1;
+            }
+            p++;
+        } else {
+            p += strspn(p, "0123456789");
+        }
+        if (*p == '.') {
+            p++;
+            if (*p == '*') {
+                precision = va_arg(ap, int);
+                if (!usr_log_bin_put(buf, size, &pos, &precision, sizeof(precision))) {
+                    return -1;
+                }
+                p++;
+            } else {
+                precision = strtol(p, (char **)&p, 10);
+            }
+        }
+        while (*p && strchr("hlLzjtq", *p)) {
+            longs += (*p == 'l') ? 1 : (*p == 'j' || *p == 'q') ? 2 : 0;
+            long_double |= (*p == 'L');
+            p++;
+        }
+
+        bool ok;
+        switch (*p) {
+        case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'c':
+            if (longs >= 2) {
+                long long val = va_arg(ap, long long);
+                ok = usr_log_bin_put(buf, size, &pos, &val, sizeof(val));
+            } else {
+                int val = va_arg(ap, int);
+                ok = usr_log_bin_put(buf, size, &pos, &val, sizeof(val));
+            }
+            break;
+        case 'p': {
+            void *val = va_arg(ap, void *);
+            ok = usr_log_bin_put(buf, size, &pos, &val, sizeof(val));
+            break;
+        }
+        case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A': {
+            if (long_double) {
+                return -1;
+            }
+            double val = va_arg(ap, double);
+            ok = usr_log_bin_put(buf, size, &pos, &val, sizeof(val));
+            break;
+        }
+        case 's': {
+            const char *str = va_arg(ap, const char *);
+            if (str == NULL) {
+                str = "(null)";
+            }
+            /* The string may not be terminated within the precision */
+            uint8_t len = strnlen(str, (precision >= 0 && precision < UINT8_MAX) ? precision : UINT8_MAX);
+            ok = usr_log_bin_put(buf, size, &pos, &len, sizeof(len)) && usr_log_bin_put(buf, size, &pos, str, len);
+            break;
+        }
+        default:
+            /* %n and unknown conversions are left to vprintf */
+            return -1;
+        }
+        if (!ok) {
+            return -1;
+        }
+        p++;
+    }
+
+    uint16_t payload_len = pos - 4;
+    uint32_t fmt_offset = (uint32_t)fmt - (uint32_t)&_user_rodata_start;
+    uint32_t timestamp = esp_log_timestamp();
+    buf[0] = USR_LOG_BIN_MAGIC0;
+    buf[1] = USR_LOG_BIN_MAGIC1;
+    memcpy(&buf[2], &payload_len, sizeof(payload_len));
+    memcpy(&buf[4], &fmt_offset, sizeof(fmt_offset));
+    memcpy(&buf[8], &timestamp, sizeof(timestamp));
+    return pos;
+}
+
+/* Escape a record of len bytes in place. Returns its new length, or -1 if it does not fit in buf */
+static int usr_log_bin_escape(uint8_t *buf, size_t size, size_t len)
+{
+    size_t escaped_len = len;
+    for (size_t i = 2; i < len; i++) {
+        escaped_len += USR_LOG_BIN_NEEDS_ESC(buf[i]);
+    }
+    if (escaped_len > size) {
+        return -1;
+    }
+    /* Move the bytes from the end so that none is overwritten before it is moved */
+    for (size_t i = len, j = escaped_len; i > 2;) {
+        uint8_t c = buf[--i];
+        if (USR_LOG_BIN_NEEDS_ESC(c)) {
+            buf[--j] = c ^ USR_LOG_BIN_ESC_XOR;
+            buf[--j] = USR_LOG_BIN_ESC;
+        } else {
+            buf[--j] = c;
+        }
+    }
+    return escaped_len;
+}
+#endif
+
+int usr_vprintf(const char * fmt, va_list ap)
+{
+#if CONFIG_ESP_SYSCALL_USER_LOG_BINARY
+    /* ESP_LOG formats are literals, other formats are printed as text */
+    if (fmt >= (const char *)&_user_rodata_start && fmt < (const char *)&_user_rodata_end) {
+        uint8_t buff[USR_LOG_LINE_BUF_SIZE];
+        va_list ap_copy;
+        va_copy(ap_copy, ap);
+        int len = usr_log_bin_encode(buff, sizeof(buff), fmt, ap_copy);
+        va_end(ap_copy);
+        if (len > 0) {
+            len = usr_log_bin_escape(buff, sizeof(buff), len);
+        }
+        if (len > 0) {
+            return usr_write_log_line((const char *)buff, len) < 0 ? -1 : len;
+        }
+    }
+#endif
+    return usr_log_vprintf(usr_write_log_line, fmt, ap);
 }
 
 int usr_printf(const char *fmt, ...)
 {
-    int ret = 0;
-    char *str_ptr = NULL;
+    int ret;
     va_list ap;
     va_start(ap, fmt);
-    if (_is_heap_initialized) {
-        ret = vasprintf(&str_ptr, fmt, ap);
-        assert(str_ptr != NULL);
-    } else {
-        char buff[256];
-        ret = vsnprintf(buff, sizeof(buff), fmt, ap);
-        str_ptr = buff;
-    }
+    ret = usr_log_vprintf(usr_write_log_line, fmt, ap);
     va_end(ap);
-    ret = usr_write_log_line(str_ptr, ret);
-    if (_is_heap_initialized) {
-        free(str_ptr);
-    }
     return ret;
 }
 
 int usr_ets_printf(const char *fmt, ...)
 {
-    int ret = 0;
-    char *str_ptr = NULL;
+    int ret;
     va_list ap;
     va_start(ap, fmt);
-    if (_is_heap_initialized) {
-        ret = vasprintf(&str_ptr, fmt, ap);
-        assert(str_ptr != NULL);
-    } else {
-        char buff[256];
-        ret = vsnprintf(buff, sizeof(buff), fmt, ap);
-        str_ptr = buff;
-    }
+    ret = usr_log_vprintf(usr_write_log_line_unlocked, fmt, ap);
     va_end(ap);
-    ret = usr_write_log_line_unlocked(str_ptr, ret);
-    if (_is_heap_initialized) {
-        free(str_ptr);
-    }
     return ret;
 }
 
@@ -11,12 +11,15 @@
 // WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 // See the License for the specific language governing permissions and
 // limitations under the License.
+#include <stdlib.h>
+#include <sys/param.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 
 #include <esp_log.h>
 #include <esp_console.h>
 #include <esp_heap_caps.h>
+#include <hal/cpu_hal.h>
 
 #include <user_console.h>
 #include <syscall_structs.h>
@@ -24,6 +27,12 @@
 static const char *TAG = "user_console";
 
 esp_err_t usr_esp_get_protected_heap_stats(protected_heap_stats_t *);
+esp_err_t usr_esp_map_get_stats(esp_map_stats_t *);
+esp_err_t usr_esp_syscall_trace_get_stats(uint32_t, esp_syscall_trace_stats_t *);
+int usr_esp_syscall_trace_get_records(esp_syscall_trace_record_t *, uint32_t);
+
+#define SYSCALL_TRACE_RECORDS   16
+#define SYSCALL_BENCH_CALLS     1000
 
 static int protected_mem_dump_cli_handler(int argc, char *argv[])
 {
@@ -36,6 +45,101 @@ static int protected_mem_dump_cli_handler(int argc, char *argv[])
             stats.largest_free_block);
     printf("Min. Ever Free Size\t%d\n",
             stats.min_free_heap);
+    printf("Handles In Use\t\t%d/%d\n",
+            stats.map_used_handles, stats.map_total_handles);
+    printf("Handle Table Size\t%d\n",
+            stats.map_memory_size);
+    return 0;
+}
+
+static int esp_map_stats_cli_handler(int argc, char *argv[])
+{
+    static const char *type_names[ESP_MAP_STATS_TYPES] = {
+        "Queue", "Task", "esp_timer", "xTimer", "Event Group", "esp_netif", "GPIO", "Other"
+    };
+    esp_map_stats_t stats = {0};
+    esp_err_t ret = usr_esp_map_get_stats(&stats);
+    printf("Handles In Use\t\t%u/%u\n", stats.used_handles, stats.total_handles);
+    if (ret == ESP_ERR_NOT_SUPPORTED) {
+        printf("Enable CONFIG_ESP_SYSCALL_MAP_STATS in protected app for more statistics\n");
+        return 0;
+    } else if (ret != ESP_OK) {
+        return 1;
+    }
+    printf("Peak Handles In Use\t%u\n", stats.peak_handles);
+    printf("Adds\t\t\t%u\n", stats.adds);
+    printf("Removes\t\t\t%u\n", stats.removes);
+    printf("Grows\t\t\t%u\n", stats.grows);
+    printf("Shrinks\t\t\t%u\n", stats.shrinks);
+    printf("Verify Hits\t\t%u\n", stats.verify_hits);
+    for (int i = 0; i < ESP_MAP_STATS_TYPES; i++) {
+        if (stats.verify_misses[i]) {
+            printf("Verify Misses (%s)\t%u\n", type_names[i], stats.verify_misses[i]);
+        }
+    }
+    printf("Lock Acquisitions\t%u\n", stats.lock_acquisitions);
+    printf("Lock Wait Cycles\t%llu\n", stats.lock_wait_cycles);
+    printf("Lock Max Wait Cycles\t%u\n", stats.lock_max_wait_cycles);
+    return 0;
+}
+
+static int syscall_trace_cli_handler(int argc, char *argv[])
+{
+    esp_syscall_trace_stats_t stats;
+    esp_err_t ret = usr_esp_syscall_trace_get_stats(0, &stats);
+    if (ret == ESP_ERR_NOT_SUPPORTED) {
+        printf("Enable CONFIG_ESP_SYSCALL_TRACE in protected app to trace system calls\n");
+        return 0;
+    }
+
+    printf("Syscall\tCalls\tAvg Cycles\tMax Cycles\tHistogram (log2 cycles: calls)\n");
+    for (uint32_t i = 0; ret == ESP_OK; ret = usr_esp_syscall_trace_get_stats(++i, &stats)) {
+        printf("%u\t%u\t%llu\t\t%u\t\t", stats.nr, stats.count, stats.total_cycles / stats.count, stats.max_cycles);
+        for (int b = 0; b < ESP_SYSCALL_TRACE_HIST_BUCKETS; b++) {
+            if (stats.hist[b]) {
+                printf("%d: %u ", b + 8, stats.hist[b]);
+            }
+        }
+        printf("\n");
+    }
+
+    esp_syscall_trace_record_t *records = calloc(SYSCALL_TRACE_RECORDS, sizeof(esp_syscall_trace_record_t));
+    if (!records) {
+        ESP_LOGE(TAG, "Failed to allocate memory for syscall records");
+        return 1;
+    }
+    int count = usr_esp_syscall_trace_get_records(records, SYSCALL_TRACE_RECORDS);
+    printf("\nRecent Syscalls\nSyscall\tCycles\t\tStart Cycles\tTask\n");
+    for (int i = 0; i < count; i++) {
+        printf("%u\t%u\t\t%u\t%p\n", records[i].nr, records[i].cycles, records[i].start_cycles, records[i].task);
+    }
+    free(records);
+    return 0;
+}
+
+/*
+ * Measure the round trip of a system call from user app, including the entry and the return
+ * paths of the system call handler. uxTaskPriorityGet() is a system call which does almost no
+ * work in protected app. Interrupts and context switches may inflate the average, the
+ * minimum is the cost of the bare round trip.
+ */
+static int syscall_bench_cli_handler(int argc, char *argv[])
+{
+    uint32_t min_cycles = UINT32_MAX;
+    uint64_t total_cycles = 0;
+    for (int i = 0; i < SYSCALL_BENCH_CALLS; i++) {
+        uint32_t start = cpu_hal_get_cycle_count();
+        uxTaskPriorityGet(NULL);
+        uint32_t cycles = cpu_hal_get_cycle_count() - start;
+        min_cycles = MIN(min_cycles, cycles);
+        total_cycles += cycles;
+    }
+    printf("System Calls	%d
+", SYSCALL_BENCH_CALLS);
+    printf("Avg Cycles	%llu
+", total_cycles / SYSCALL_BENCH_CALLS);
+    printf("Min Cycles	%u
+", min_cycles);
     return 0;
 }
 
@@ -57,6 +161,21 @@ static const esp_console_cmd_t debug_commands[] = {
         .help = "Get the available memory for protected app.",
         .func = protected_mem_dump_cli_handler,
     },
+    {
+        .command = "esp-map-stats",
+        .help = "Get the handle table statistics of protected app.",
+        .func = esp_map_stats_cli_handler,
+    },
+    {
+        .command = "syscall-trace",
+        .help = "Get the latency of system calls and the most recent ones (task handle, NULL if not created by user app).",
+        .func = syscall_trace_cli_handler,
+    },
+    {
+        .command = "syscall-bench",
+        .help = "Measure the CPU cycles taken by a system call round trip from user app.",
+        .func = syscall_bench_cli_handler,
+    },
     {
         .command = "user-mem-dump",
         .help = "Get the available memory for user app.",
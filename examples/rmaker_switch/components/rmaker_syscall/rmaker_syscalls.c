@@ -101,21 +101,8 @@ esp_err_t sys_write_cb(const esp_rmaker_device_t *device, const esp_rmaker_param
         return ESP_FAIL;
     }
 
-    int user_handles = esp_map_get_allocated_size();
-    int device_index = 0, param_index = 0;
-    for (int i = ESP_MAP_INDEX_OFFSET; i < (ESP_MAP_INDEX_OFFSET + user_handles); i++) {
-        esp_map_handle_t *wrapper_handle = esp_map_get_handle(i);
-        if (!wrapper_handle) {
-            continue;
-        } else if (device == wrapper_handle->handle) {
-            device_index = i;
-        } else if (param == wrapper_handle->handle) {
-            param_index = i;
-        }
-        if (device_index && param_index) {
-            break;
-        }
-    }
+    int device_index = esp_map_lookup_by_ptr(device, ESP_MAP_RMAKER_DEVICE_ID);
+    int param_index = esp_map_lookup_by_ptr(param, ESP_MAP_RMAKER_PARAM_ID);
     if (!device_index || !param_index) {
         ESP_LOGE(TAG, "Failed to get indexes in esp_map");
         return ESP_FAIL;
@@ -280,17 +267,7 @@ esp_rmaker_param_t *sys_esp_rmaker_device_get_param_by_name(const esp_rmaker_dev
         return NULL;
     }
     esp_rmaker_param_t *param = esp_rmaker_device_get_param_by_name((const esp_rmaker_device_t *)wrapper_handle->handle, param_name);
-    int allocated_handles = esp_map_get_allocated_size();
-    for (int i = ESP_MAP_INDEX_OFFSET; i < (ESP_MAP_INDEX_OFFSET + allocated_handles); i++) {
-        esp_map_handle_t *wrapper_handle = esp_map_get_handle(i);
-        if (!wrapper_handle) {
-            continue;
-        }
-        if (wrapper_handle->handle == param) {
-            return (esp_rmaker_param_t *)i;
-        }
-    }
-    return NULL;
+    return (esp_rmaker_param_t *)esp_map_lookup_by_ptr(param, ESP_MAP_RMAKER_PARAM_ID);
 }
 
 esp_rmaker_param_t *sys_esp_rmaker_device_get_param_by_type(const esp_rmaker_device_t *device, const char *param_type, int type_len)
@@ -306,18 +283,7 @@ esp_rmaker_param_t *sys_esp_rmaker_device_get_param_by_type(const esp_rmaker_dev
         return NULL;
     }
     esp_rmaker_param_t *param = esp_rmaker_device_get_param_by_type((const esp_rmaker_device_t *)wrapper_handle->handle, param_type);
-
-    int user_handles = esp_map_get_allocated_size();
-    for (int i = ESP_MAP_INDEX_OFFSET; i < (ESP_MAP_INDEX_OFFSET + user_handles); i++) {
-        esp_map_handle_t *param_handle = esp_map_get_handle(i);
-        if (!param_handle) {
-            continue;
-        }
-        if (param_handle->handle == param) {
-            return (esp_rmaker_param_t *)i;
-        }
-    }
-    return NULL;
+    return (esp_rmaker_param_t *)esp_map_lookup_by_ptr(param, ESP_MAP_RMAKER_PARAM_ID);
 }
 
 esp_err_t sys_esp_rmaker_param_add_ui_type(const esp_rmaker_param_t *param, const char *ui_type, int ui_len)
@@ -0,0 +1,130 @@
+// Copyright 2020-2022 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//         http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+/*
+ * Host-side microbenchmark for esp_map.
+ *
+ * The map only grows, so table sizes are measured in increasing order: for every size the
+ * map is filled up to that many handles and then each operation is timed on the filled map.
+ * Host numbers are only meaningful relative to each other, e.g. to compare two revisions of
+ * esp_map on the same machine.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <esp_map.h>
+
+#define BENCH_MIN_SIZE      64
+#define BENCH_MAX_SIZE      4096
+#define BENCH_LOOKUPS       (1 << 20)
+#define BENCH_CHURN         (1 << 16)
+
+static volatile uintptr_t bench_sink;
+
+static uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static double bench_ns_per_op(uint64_t start, uint64_t end, int ops)
+{
+    return ops ? (double)(end - start) / ops : 0;
+}
+
+int main(void)
+{
+    static char objs[BENCH_MAX_SIZE];
+    static int indices[BENCH_MAX_SIZE];
+    static uint16_t order[BENCH_LOOKUPS];
+    int count = 0;
+    uint64_t start;
+
+    printf("%8s %10s %10s %10s %10s %10s %10s %10s\n", "handles", "fill", "add", "remove", "verify", "verify_isr", "by_ptr", "miss");
+    for (int size = BENCH_MIN_SIZE; size <= BENCH_MAX_SIZE; size *= 2) {
+        /* Fill from the previous size to this one, includes growing the map */
+        int added = size - count;
+        start = bench_now_ns();
+        for (; count < size; count++) {
+            indices[count] = esp_map_add(&objs[count], ESP_MAP_QUEUE_ID);
+        }
+        double fill_ns = bench_ns_per_op(start, bench_now_ns(), added);
+        if (indices[size - 1] == 0) {
+            fprintf(stderr, "esp_map_add failed at %d handles\n", size);
+            return 1;
+        }
+
+        /* Random access order, so the results are not dominated by a single hot cache line */
+        srand(size);
+        for (int i = 0; i < BENCH_LOOKUPS; i++) {
+            order[i] = rand() % size;
+        }
+
+        start = bench_now_ns();
+        for (int i = 0; i < BENCH_LOOKUPS; i++) {
+            bench_sink += (uintptr_t)esp_map_verify(indices[order[i]], ESP_MAP_QUEUE_ID);
+        }
+        double verify_ns = bench_ns_per_op(start, bench_now_ns(), BENCH_LOOKUPS);
+
+        start = bench_now_ns();
+        for (int i = 0; i < BENCH_LOOKUPS; i++) {
+            bench_sink += (uintptr_t)esp_map_verify_from_isr(indices[order[i]], ESP_MAP_QUEUE_ID);
+        }
+        double verify_isr_ns = bench_ns_per_op(start, bench_now_ns(), BENCH_LOOKUPS);
+
+        start = bench_now_ns();
+        for (int i = 0; i < BENCH_LOOKUPS; i++) {
+            bench_sink += esp_map_lookup_by_ptr(&objs[order[i]], ESP_MAP_QUEUE_ID);
+        }
+        double by_ptr_ns = bench_ns_per_op(start, bench_now_ns(), BENCH_LOOKUPS);
+
+        /* Type mismatch, the common way a bogus handle from user app is rejected */
+        start = bench_now_ns();
+        for (int i = 0; i < BENCH_LOOKUPS; i++) {
+            bench_sink += (uintptr_t)esp_map_verify(indices[order[i]], ESP_MAP_TASK_ID);
+        }
+        double miss_ns = bench_ns_per_op(start, bench_now_ns(), BENCH_LOOKUPS);
+
+        /* Steady state churn: remove half of the handles and add them back, the map does not grow */
+        int batch = size / 2;
+        uint64_t remove_total = 0, add_total = 0;
+        for (int round = 0; round < BENCH_CHURN / batch; round++) {
+            int first = (round * batch) % size;
+            start = bench_now_ns();
+            for (int i = 0; i < batch; i++) {
+                esp_map_remove(indices[(first + i) % size]);
+            }
+            uint64_t mid = bench_now_ns();
+            for (int i = 0; i < batch; i++) {
+                indices[(first + i) % size] = esp_map_add(&objs[(first + i) % size], ESP_MAP_QUEUE_ID);
+            }
+            remove_total += mid - start;
+            add_total += bench_now_ns() - mid;
+        }
+        double remove_ns = (double)remove_total / BENCH_CHURN;
+        double add_ns = (double)add_total / BENCH_CHURN;
+
+        printf("%8d %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n", size, fill_ns, add_ns, remove_ns,
+               verify_ns, verify_isr_ns, by_ptr_ns, miss_ns);
+    }
+
+    int used, total, memory_size;
+    esp_map_get_usage(&used, &total, &memory_size);
+    printf("ns/op, %d handles in use, %d allocated, %d bytes\n", used, total, memory_size);
+    return 0;
+}
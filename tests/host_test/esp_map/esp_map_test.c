@@ -0,0 +1,465 @@
+// Copyright 2020-2022 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//         http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+/*
+ * Host-side functional tests for esp_map.
+ *
+ * esp_map is a singleton initialized by its constructor, so every test releases the
+ * handles it adds and the next test starts from an empty (but possibly grown) map.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <esp_map.h>
+#include "syscall_structs.h"
+
+#define TEST_ASSERT(cond)   do {                                                    \
+        if (!(cond)) {                                                              \
+            fprintf(stderr, "%s:%d: assertion failed: %s\n", __FILE__, __LINE__, #cond);  \
+            exit(1);                                                                \
+        }                                                                           \
+    } while (0)
+
+#define RANDOM_OBJECTS      3000
+#define RANDOM_ITERATIONS   200000
+#define THREAD_WRITERS      2
+#define THREAD_READERS      3
+#define THREAD_HANDLES      1000
+#define THREAD_ROUNDS       200
+
+static const int test_types[] = {
+    ESP_MAP_QUEUE_ID,
+    ESP_MAP_TASK_ID,
+    ESP_MAP_ESP_TIMER_ID,
+    ESP_MAP_XTIMER_ID,
+    ESP_MAP_EVENT_GROUP_ID,
+    ESP_MAP_ESP_NETIF_ID,
+    ESP_MAP_GPIO_ID,
+    0xF5A9,                 // Component specific type, kept in the "other" list
+};
+
+#define TEST_TYPE_COUNT     (sizeof(test_types) / sizeof(test_types[0]))
+
+static int map_used_handles(void)
+{
+    int used, total, memory_size;
+    esp_map_get_usage(&used, &total, &memory_size);
+    return used;
+}
+
+static void test_add_verify_remove(void)
+{
+    int obj_a, obj_b;
+
+    int index = esp_map_add(&obj_a, ESP_MAP_QUEUE_ID);
+    TEST_ASSERT(index != 0);
+    TEST_ASSERT(map_used_handles() == 1);
+
+    esp_map_handle_t *wrapper = esp_map_verify(index, ESP_MAP_QUEUE_ID);
+    TEST_ASSERT(wrapper != NULL);
+    TEST_ASSERT(ESP_MAP_GET_RAW_HANDLE(wrapper) == &obj_a);
+    TEST_ASSERT(ESP_MAP_GET_ID(wrapper) == ESP_MAP_QUEUE_ID);
+    TEST_ASSERT(esp_map_verify_from_isr(index, ESP_MAP_QUEUE_ID) == wrapper);
+    TEST_ASSERT(esp_map_get_handle(index) == wrapper);
+
+    /* Wrong type and malformed indices */
+    TEST_ASSERT(esp_map_verify(index, ESP_MAP_TASK_ID) == NULL);
+    TEST_ASSERT(esp_map_verify_from_isr(index, ESP_MAP_TASK_ID) == NULL);
+    TEST_ASSERT(esp_map_verify(0, ESP_MAP_QUEUE_ID) == NULL);
+    TEST_ASSERT(esp_map_verify(ESP_MAP_INDEX_OFFSET - 1, ESP_MAP_QUEUE_ID) == NULL);
+    TEST_ASSERT(esp_map_verify(-1, ESP_MAP_QUEUE_ID) == NULL);
+    TEST_ASSERT(esp_map_verify(ESP_MAP_INDEX_MASK, ESP_MAP_QUEUE_ID) == NULL);
+    TEST_ASSERT(esp_map_verify(index | (1 << 28), ESP_MAP_QUEUE_ID) == NULL);
+    TEST_ASSERT(esp_map_get_handle(index + ESP_MAP_MAX_HANDLES) == NULL);
+
+    TEST_ASSERT(esp_map_lookup_by_ptr(&obj_a, ESP_MAP_QUEUE_ID) == index);
+    TEST_ASSERT(esp_map_lookup_by_ptr(&obj_a, 0) == index);
+    TEST_ASSERT(esp_map_lookup_by_ptr(&obj_a, ESP_MAP_TASK_ID) == 0);
+    TEST_ASSERT(esp_map_lookup_by_ptr(&obj_b, 0) == 0);
+    TEST_ASSERT(esp_map_lookup_by_ptr(NULL, 0) == 0);
+
+    /* Slot is reused with a new generation, the stale index must be rejected */
+    esp_map_remove(index);
+    TEST_ASSERT(map_used_handles() == 0);
+    TEST_ASSERT(esp_map_verify(index, ESP_MAP_QUEUE_ID) == NULL);
+    TEST_ASSERT(esp_map_lookup_by_ptr(&obj_a, 0) == 0);
+
+    int new_index = esp_map_add(&obj_b, ESP_MAP_QUEUE_ID);
+    TEST_ASSERT(new_index != 0);
+    TEST_ASSERT(ESP_MAP_INDEX_TO_SLOT(new_index) == ESP_MAP_INDEX_TO_SLOT(index));
+    TEST_ASSERT(ESP_MAP_INDEX_TO_GEN(new_index) != ESP_MAP_INDEX_TO_GEN(index));
+    TEST_ASSERT(esp_map_verify(index, ESP_MAP_QUEUE_ID) == NULL);
+    TEST_ASSERT(ESP_MAP_GET_RAW_HANDLE(esp_map_verify(new_index, ESP_MAP_QUEUE_ID)) == &obj_b);
+
+    /* Removing a stale or invalid index must not release the live handle */
+    esp_map_remove(index);
+    esp_map_remove(0);
+    TEST_ASSERT(esp_map_verify(new_index, ESP_MAP_QUEUE_ID) != NULL);
+
+    esp_map_remove(new_index);
+    TEST_ASSERT(map_used_handles() == 0);
+}
+
+static void test_grow(void)
+{
+    const int count = 4096 + 7;
+    int *indices = calloc(count, sizeof(int));
+    char *objs = calloc(count, 1);
+    TEST_ASSERT(indices && objs);
+
+    int initial_size = esp_map_get_allocated_size();
+    for (int i = 0; i < count; i++) {
+        indices[i] = esp_map_add(&objs[i], test_types[i % TEST_TYPE_COUNT]);
+        TEST_ASSERT(indices[i] != 0);
+        /* Handles added before a grow must stay valid after it */
+        TEST_ASSERT(esp_map_verify(indices[i / 2], test_types[(i / 2) % TEST_TYPE_COUNT]) != NULL);
+    }
+    TEST_ASSERT(esp_map_get_allocated_size() >= count);
+    TEST_ASSERT(esp_map_get_allocated_size() >= initial_size);
+    TEST_ASSERT(map_used_handles() == count);
+
+    for (int i = 0; i < count; i++) {
+        esp_map_handle_t *wrapper = esp_map_verify(indices[i], test_types[i % TEST_TYPE_COUNT]);
+        TEST_ASSERT(wrapper && ESP_MAP_GET_RAW_HANDLE(wrapper) == &objs[i]);
+        TEST_ASSERT(esp_map_lookup_by_ptr(&objs[i], 0) == indices[i]);
+    }
+    for (int i = 0; i < count; i++) {
+        esp_map_remove(indices[i]);
+    }
+    TEST_ASSERT(map_used_handles() == 0);
+    free(indices);
+    free(objs);
+}
+
+/* Pages emptied by a burst of handles are freed, and the other handles stay valid */
+static void test_shrink(void)
+{
+    const int burst = 1000;
+    static char objs[1000];
+    static int indices[1000];
+    int keep_obj;
+
+    int keep = esp_map_add(&keep_obj, ESP_MAP_TASK_ID);
+    TEST_ASSERT(keep != 0);
+    for (int i = 0; i < burst; i++) {
+        indices[i] = esp_map_add(&objs[i], ESP_MAP_XTIMER_ID);
+        TEST_ASSERT(indices[i] != 0);
+    }
+    TEST_ASSERT(esp_map_get_allocated_size() > burst);
+    for (int i = 0; i < burst; i++) {
+        esp_map_remove(indices[i]);
+    }
+    /* Only the page holding the remaining handle is left */
+    int page_size = esp_map_get_allocated_size();
+    TEST_ASSERT(page_size < burst / 4);
+    TEST_ASSERT(ESP_MAP_INDEX_TO_SLOT(keep) < page_size);
+    TEST_ASSERT(ESP_MAP_GET_RAW_HANDLE(esp_map_verify(keep, ESP_MAP_TASK_ID)) == &keep_obj);
+    TEST_ASSERT(esp_map_lookup_by_ptr(&keep_obj, 0) == keep);
+
+    /* Indices into freed pages are rejected, and stay rejected once the pages are allocated again */
+    int stale = indices[burst - 1];
+    TEST_ASSERT(ESP_MAP_INDEX_TO_SLOT(stale) >= page_size);
+    TEST_ASSERT(esp_map_verify(stale, ESP_MAP_XTIMER_ID) == NULL);
+    esp_map_remove(stale);
+    for (int i = 0; i < burst; i++) {
+        indices[i] = esp_map_add(&objs[i], ESP_MAP_XTIMER_ID);
+        TEST_ASSERT(indices[i] != 0 && indices[i] != stale);
+    }
+    TEST_ASSERT(esp_map_verify(stale, ESP_MAP_XTIMER_ID) == NULL);
+
+    /* Keep the handles of the last page only, the emptied pages before it leave holes */
+    int last_page = ESP_MAP_INDEX_TO_SLOT(indices[burst - 1]) / page_size;
+    int kept = 0;
+    for (int i = 0; i < burst; i++) {
+        if (ESP_MAP_INDEX_TO_SLOT(indices[i]) / page_size == last_page) {
+            kept++;
+        } else {
+            esp_map_remove(indices[i]);
+            indices[i] = 0;
+        }
+    }
+    TEST_ASSERT(map_used_handles() == kept + 1);
+    TEST_ASSERT(esp_map_get_allocated_size() < (last_page + 1) * page_size);
+    for (int i = 0; i < burst; i++) {
+        if (indices[i]) {
+            esp_map_handle_t *wrapper = esp_map_verify(indices[i], ESP_MAP_XTIMER_ID);
+            TEST_ASSERT(wrapper && ESP_MAP_GET_RAW_HANDLE(wrapper) == &objs[i]);
+            TEST_ASSERT(esp_map_lookup_by_ptr(&objs[i], 0) == indices[i]);
+        }
+    }
+    /* New handles fill the lowest pages first */
+    for (int i = 0; i < burst; i++) {
+        if (!indices[i]) {
+            indices[i] = esp_map_add(&objs[i], ESP_MAP_XTIMER_ID);
+            TEST_ASSERT(indices[i] != 0);
+            TEST_ASSERT(ESP_MAP_INDEX_TO_SLOT(indices[i]) / page_size != last_page);
+            break;
+        }
+    }
+
+    for (int i = 0; i < burst; i++) {
+        if (indices[i]) {
+            esp_map_remove(indices[i]);
+        }
+    }
+    esp_map_remove(keep);
+    TEST_ASSERT(map_used_handles() == 0);
+    TEST_ASSERT(esp_map_get_allocated_size() == page_size);
+}
+
+static void test_exhaust(void)
+{
+    int *indices = calloc(ESP_MAP_MAX_HANDLES + 1, sizeof(int));
+    TEST_ASSERT(indices);
+
+    int count = 0;
+    /* Any distinct non-NULL pointer will do, the handles are never dereferenced */
+    while ((indices[count] = esp_map_add((void *)(uintptr_t)(0x1000 + 4 * count), ESP_MAP_QUEUE_ID)) != 0) {
+        count++;
+        TEST_ASSERT(count <= ESP_MAP_MAX_HANDLES);
+    }
+    TEST_ASSERT(count == ESP_MAP_MAX_HANDLES);
+    TEST_ASSERT(esp_map_get_allocated_size() == ESP_MAP_MAX_HANDLES);
+
+    /* A released slot can be taken again when the map is full */
+    esp_map_remove(indices[count / 2]);
+    indices[count / 2] = esp_map_add(&indices[0], ESP_MAP_QUEUE_ID);
+    TEST_ASSERT(indices[count / 2] != 0);
+    TEST_ASSERT(esp_map_add(&indices[1], ESP_MAP_QUEUE_ID) == 0);
+
+    for (int i = 0; i < count; i++) {
+        esp_map_remove(indices[i]);
+    }
+    TEST_ASSERT(map_used_handles() == 0);
+    free(indices);
+}
+
+/* Random add/verify/remove sequence checked against a shadow copy of the expected state */
+static void test_random(unsigned int seed)
+{
+    static char objs[RANDOM_OBJECTS];
+    static int indices[RANDOM_OBJECTS];
+    int live = 0;
+
+    srand(seed);
+    memset(indices, 0, sizeof(indices));
+    for (int iter = 0; iter < RANDOM_ITERATIONS; iter++) {
+        int i = rand() % RANDOM_OBJECTS;
+        int type = test_types[i % TEST_TYPE_COUNT];
+        int other_type = test_types[(i + 1) % TEST_TYPE_COUNT];
+
+        if (indices[i]) {
+            esp_map_handle_t *wrapper = esp_map_verify(indices[i], type);
+            TEST_ASSERT(wrapper && ESP_MAP_GET_RAW_HANDLE(wrapper) == &objs[i]);
+            TEST_ASSERT(esp_map_verify(indices[i], other_type) == NULL);
+            TEST_ASSERT(esp_map_lookup_by_ptr(&objs[i], type) == indices[i]);
+            TEST_ASSERT(esp_map_lookup_by_ptr(&objs[i], other_type) == 0);
+            if (rand() & 1) {
+                int stale = indices[i];
+                esp_map_remove(stale);
+                indices[i] = 0;
+                live--;
+                TEST_ASSERT(esp_map_verify(stale, type) == NULL);
+            }
+        } else {
+            TEST_ASSERT(esp_map_lookup_by_ptr(&objs[i], 0) == 0);
+            indices[i] = esp_map_add(&objs[i], type);
+            TEST_ASSERT(indices[i] != 0);
+            live++;
+        }
+        if ((iter & 0x3FFF) == 0) {
+            TEST_ASSERT(map_used_handles() == live);
+        }
+    }
+    for (int i = 0; i < RANDOM_OBJECTS; i++) {
+        if (indices[i]) {
+            esp_map_remove(indices[i]);
+        }
+    }
+    TEST_ASSERT(map_used_handles() == 0);
+}
+
+typedef struct {
+    int count[TEST_TYPE_COUNT];
+    int remove_type;
+} for_each_ctx_t;
+
+static void for_each_cb(int wrapper_index, esp_map_handle_t *wrapper_handle, void *arg)
+{
+    for_each_ctx_t *ctx = arg;
+    TEST_ASSERT(esp_map_verify(wrapper_index, ESP_MAP_GET_ID(wrapper_handle)) == wrapper_handle);
+    for (int t = 0; t < TEST_TYPE_COUNT; t++) {
+        if (test_types[t] == ESP_MAP_GET_ID(wrapper_handle)) {
+            ctx->count[t]++;
+        }
+    }
+    if (ctx->remove_type == ESP_MAP_GET_ID(wrapper_handle)) {
+        esp_map_remove(wrapper_index);
+    }
+}
+
+static void test_for_each(void)
+{
+    const int count = 500;
+    static char objs[500];
+    static int indices[500];
+    int expected[TEST_TYPE_COUNT] = { 0 };
+
+    for (int i = 0; i < count; i++) {
+        int t = (i * 7) % TEST_TYPE_COUNT;
+        indices[i] = esp_map_add(&objs[i], test_types[t]);
+        TEST_ASSERT(indices[i] != 0);
+        expected[t]++;
+    }
+    /* Free a few slots so the lists are not in insertion order */
+    for (int i = 0; i < count; i += 5) {
+        esp_map_remove(indices[i]);
+        expected[(i * 7) % TEST_TYPE_COUNT]--;
+        indices[i] = esp_map_add(&objs[i], test_types[(i * 7) % TEST_TYPE_COUNT]);
+        expected[(i * 7) % TEST_TYPE_COUNT]++;
+    }
+
+    for_each_ctx_t ctx = { 0 };
+    esp_map_for_each_type(0, for_each_cb, &ctx);
+    TEST_ASSERT(memcmp(ctx.count, expected, sizeof(expected)) == 0);
+
+    for (int t = 0; t < TEST_TYPE_COUNT; t++) {
+        memset(&ctx, 0, sizeof(ctx));
+        ctx.remove_type = test_types[t];
+        esp_map_for_each_type(test_types[t], for_each_cb, &ctx);
+        for (int u = 0; u < TEST_TYPE_COUNT; u++) {
+            TEST_ASSERT(ctx.count[u] == (u == t ? expected[t] : 0));
+        }
+        /* The callback removed every handle of the type */
+        memset(&ctx, 0, sizeof(ctx));
+        esp_map_for_each_type(test_types[t], for_each_cb, &ctx);
+        TEST_ASSERT(ctx.count[t] == 0);
+    }
+    TEST_ASSERT(map_used_handles() == 0);
+}
+
+static volatile bool threads_stop;
+
+/* Readers verify random indices while the writers add, remove and grow the map */
+static void *reader_thread(void *arg)
+{
+    unsigned int seed = (unsigned int)(uintptr_t)arg;
+    int max_index = ESP_MAP_INDEX_OFFSET + THREAD_WRITERS * THREAD_HANDLES * 2;
+
+    while (!threads_stop) {
+        int index = ESP_MAP_INDEX_OFFSET + rand_r(&seed) % (max_index - ESP_MAP_INDEX_OFFSET);
+        esp_map_handle_t *wrapper = esp_map_verify(index, test_types[index % 2]);
+        (void)wrapper;
+        esp_map_lookup_by_ptr(&seed, 0);
+    }
+    return NULL;
+}
+
+static void *writer_thread(void *arg)
+{
+    int writer = (int)(uintptr_t)arg;
+    int type = test_types[writer % 2];
+    static char objs[THREAD_WRITERS][THREAD_HANDLES];
+    int indices[THREAD_HANDLES];
+
+    for (int round = 0; round < THREAD_ROUNDS; round++) {
+        for (int i = 0; i < THREAD_HANDLES; i++) {
+            indices[i] = esp_map_add(&objs[writer][i], type);
+            TEST_ASSERT(indices[i] != 0);
+        }
+        /* Handles owned by this writer cannot be removed by anyone else */
+        for (int i = 0; i < THREAD_HANDLES; i++) {
+            esp_map_handle_t *wrapper = esp_map_verify(indices[i], type);
+            TEST_ASSERT(wrapper && ESP_MAP_GET_RAW_HANDLE(wrapper) == &objs[writer][i]);
+            TEST_ASSERT(esp_map_lookup_by_ptr(&objs[writer][i], type) == indices[i]);
+        }
+        for (int i = 0; i < THREAD_HANDLES; i++) {
+            esp_map_remove(indices[i]);
+            TEST_ASSERT(esp_map_verify(indices[i], type) == NULL);
+        }
+    }
+    return NULL;
+}
+
+static void test_threads(void)
+{
+    pthread_t readers[THREAD_READERS], writers[THREAD_WRITERS];
+
+    threads_stop = false;
+    for (int i = 0; i < THREAD_READERS; i++) {
+        TEST_ASSERT(pthread_create(&readers[i], NULL, reader_thread, (void *)(uintptr_t)(i + 1)) == 0);
+    }
+    for (int i = 0; i < THREAD_WRITERS; i++) {
+        TEST_ASSERT(pthread_create(&writers[i], NULL, writer_thread, (void *)(uintptr_t)i) == 0);
+    }
+    for (int i = 0; i < THREAD_WRITERS; i++) {
+        pthread_join(writers[i], NULL);
+    }
+    threads_stop = true;
+    for (int i = 0; i < THREAD_READERS; i++) {
+        pthread_join(readers[i], NULL);
+    }
+    TEST_ASSERT(map_used_handles() == 0);
+}
+
+static void test_stats(void)
+{
+    esp_map_stats_t stats;
+    int obj;
+
+    esp_map_get_stats(&stats);
+    int used = stats.used_handles;
+    int index = esp_map_add(&obj, ESP_MAP_GPIO_ID);
+    TEST_ASSERT(index != 0);
+    esp_map_get_stats(&stats);
+    TEST_ASSERT(stats.used_handles == used + 1);
+    TEST_ASSERT(stats.total_handles == esp_map_get_allocated_size());
+#if CONFIG_ESP_SYSCALL_MAP_STATS
+    uint32_t adds = stats.adds, removes = stats.removes;
+    TEST_ASSERT(stats.grows > 0 && stats.shrinks > 0);
+    uint32_t hits = stats.verify_hits, misses = stats.verify_misses[0];
+    TEST_ASSERT(stats.peak_handles >= stats.used_handles);
+    TEST_ASSERT(esp_map_verify(index, ESP_MAP_GPIO_ID) != NULL);
+    TEST_ASSERT(esp_map_verify(index, ESP_MAP_QUEUE_ID) == NULL);
+    esp_map_remove(index);
+    esp_map_get_stats(&stats);
+    TEST_ASSERT(stats.adds == adds && stats.removes == removes + 1);
+    TEST_ASSERT(stats.verify_hits == hits + 1);
+    TEST_ASSERT(stats.verify_misses[0] == misses + 1);
+#else
+    esp_map_remove(index);
+#endif
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int seed = argc > 1 ? strtoul(argv[1], NULL, 0) : 1;
+
+    printf("esp_map host test, random seed %u\n", seed);
+    test_add_verify_remove();
+    test_for_each();
+    test_random(seed);
+    test_grow();
+    test_shrink();
+    test_threads();
+    test_stats();
+    /* Leaves the map at its maximum size, keep it last */
+    test_exhaust();
+    printf("All esp_map tests passed\n");
+    return 0;
+}
@@ -0,0 +1,98 @@
+// Copyright 2020-2022 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//         http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* Minimal FreeRTOS and heap_caps shim for building esp_map on a Linux host */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <pthread.h>
+#include "esp_attr.h"
+
+#define pdPASS              1
+#define pdFAIL              0
+#define pdTRUE              1
+#define pdFALSE             0
+#define portMAX_DELAY       0xFFFFFFFF
+#define portNUM_PROCESSORS  8   // Each host thread is a CPU of its own, see xPortGetCoreID
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+/* Host threads are never in ISR context */
+static inline BaseType_t xPortCanYield(void)
+{
+    return pdTRUE;
+}
+
+/*
+ * esp_map lookups mark their CPU while they run and writers wait for them before freeing
+ * memory. Host threads can be preempted anywhere, so each thread gets a CPU number of its own
+ * and a preempted lookup only delays the writers.
+ */
+static inline BaseType_t xPortGetCoreID(void)
+{
+    static int next_core;
+    static __thread int core = -1;
+
+    if (core < 0) {
+        core = __atomic_fetch_add(&next_core, 1, __ATOMIC_RELAXED);
+        assert(core < portNUM_PROCESSORS);
+    }
+    return core;
+}
+
+#define portSET_INTERRUPT_MASK_FROM_ISR()       0
+#define portCLEAR_INTERRUPT_MASK_FROM_ISR(x)    ((void)(x))
+
+/* Spinlock critical sections map to a mutex, the seqlock writer window only needs mutual exclusion */
+typedef struct {
+    pthread_mutex_t mux;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED    { PTHREAD_MUTEX_INITIALIZER }
+#define portENTER_CRITICAL(lock)        pthread_mutex_lock(&(lock)->mux)
+#define portEXIT_CRITICAL(lock)         pthread_mutex_unlock(&(lock)->mux)
+#define portENTER_CRITICAL_ISR(lock)    portENTER_CRITICAL(lock)
+#define portEXIT_CRITICAL_ISR(lock)     portEXIT_CRITICAL(lock)
+
+#define MALLOC_CAP_DEFAULT  (1 << 12)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+
+static inline void *heap_caps_malloc(size_t size, uint32_t caps)
+{
+    (void)caps;
+    return malloc(size);
+}
+
+static inline void *heap_caps_calloc(size_t n, size_t size, uint32_t caps)
+{
+    (void)caps;
+    return calloc(n, size);
+}
+
+static inline void *heap_caps_realloc(void *ptr, size_t size, uint32_t caps)
+{
+    (void)caps;
+    return realloc(ptr, size);
+}
+
+static inline void heap_caps_free(void *ptr)
+{
+    free(ptr);
+}
@@ -0,0 +1,46 @@
+// Copyright 2020-2022 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//         http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* Recursive mutex shim backed by pthreads */
+
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+typedef pthread_mutex_t *SemaphoreHandle_t;
+
+static inline SemaphoreHandle_t xSemaphoreCreateRecursiveMutex(void)
+{
+    pthread_mutexattr_t attr;
+    pthread_mutex_t *mux = malloc(sizeof(pthread_mutex_t));
+    if (!mux) {
+        return NULL;
+    }
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(mux, &attr);
+    pthread_mutexattr_destroy(&attr);
+    return mux;
+}
+
+static inline BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t mux, TickType_t ticks)
+{
+    (void)ticks;
+    return pthread_mutex_lock(mux) == 0 ? pdPASS : pdFAIL;
+}
+
+static inline BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t mux)
+{
+    return pthread_mutex_unlock(mux) == 0 ? pdPASS : pdFAIL;
+}
@@ -0,0 +1,252 @@
+#!/usr/bin/env python
+#
+# SPDX-FileCopyrightText: 2022 Espressif Systems (Shanghai) CO LTD
+#
+# SPDX-License-Identifier: Apache-2.0
+
+# Expand the binary log records sent by user app with CONFIG_ESP_SYSCALL_USER_LOG_BINARY.
+#
+# A record is laid out as:
+#   0xFF 'L' | payload length (u16) | format offset (u32) | timestamp in ms (u32) | arguments
+# Every LF, CR or ESC byte after the magic is sent as ESC followed by the byte XORed with 0x20,
+# so that line ending translation on the console cannot break the record. The payload length
+# counts the bytes before escaping.
+# The format string is read from user_app.elf, at the given offset from _user_rodata_start.
+# See usr_log_bin_encode() in syscall_wrappers.c for the encoding of the arguments.
+# Everything else in the console output is passed through unchanged.
+
+import argparse
+import codecs
+import re
+import struct
+import sys
+
+from elftools.elf.elffile import ELFFile
+from elftools.elf.sections import SymbolTableSection
+
+MAGIC = b'\xffL'
+HEADER = struct.Struct('<HII')
+ESC = 0x7D
+ESC_XOR = 0x20
+
+CONVERSION_RE = re.compile(
+    r'%(?P<flags>[-+ #0]*)(?P<width>\*|\d+)?(?:\.(?P<precision>\*|\d*))?(?P<length>hh|h|ll|l|L|z|j|t|q)?(?P<conv>[diouxXcpseEfFgGaA%])')
+
+
+class DecodeError(Exception):
+    pass
+
+
+class FormatTable(object):
+    """ Format strings of user app, read from user_app.elf """
+
+    def __init__(self, elf_file):
+        self.sections = []
+        self.cache = {}
+        self.elf = ELFFile(elf_file)
+        self.rodata_start = None
+        for section in self.elf.iter_sections():
+            if isinstance(section, SymbolTableSection):
+                symbols = section.get_symbol_by_name('_user_rodata_start')
+                if symbols:
+                    self.rodata_start = symbols[0]['st_value']
+            elif section['sh_type'] != 'SHT_NOBITS' and section['sh_addr'] and section['sh_size']:
+                self.sections.append((section['sh_addr'], section.data()))
+        if self.rodata_start is None:
+            raise RuntimeError('_user_rodata_start not found, is this user_app.elf?')
+
+    def get(self, offset):
+        if offset in self.cache:
+            return self.cache[offset]
+        addr = self.rodata_start + offset
+        for start, data in self.sections:
+            if start <= addr < start + len(data):
+                end = data.find(b'\0', addr - start)
+                if end < 0:
+                    break
+                fmt = data[addr - start:end].decode('utf-8', 'replace')
+                self.cache[offset] = fmt
+                return fmt
+        raise DecodeError('no format string at offset 0x%x' % offset)
+
+
+class ArgReader(object):
+    def __init__(self, data):
+        self.data = data
+        self.pos = 0
+
+    def unpack(self, fmt):
+        size = struct.calcsize(fmt)
+        if self.pos + size > len(self.data):
+            raise DecodeError('record too short')
+        value = struct.unpack_from(fmt, self.data, self.pos)[0]
+        self.pos += size
+        return value
+
+    def string(self):
+        length = self.unpack('<B')
+        if self.pos + length > len(self.data):
+            raise DecodeError('record too short')
+        value = self.data[self.pos:self.pos + length].decode('utf-8', 'replace')
+        self.pos += length
+        return value
+
+
+def format_record(fmt, args):
+    """ Expand a C format string with the arguments of a record """
+    out = []
+    last = 0
+    for m in CONVERSION_RE.finditer(fmt):
+        out.append(fmt[last:m.start()])
+        last = m.end()
+        conv = m.group('conv')
+        if conv == '%':
+            out.append('%')
+            continue
+        width = m.group('width') or ''
+        if width == '*':
+            width = str(args.unpack('<i'))
+        precision = m.group('precision')
+        if precision == '*':
+            precision = str(args.unpack('<i'))
+        spec = '%' + m.group('flags') + width + ('.' + precision if precision is not None else '')
+        is64 = m.group('length') in ('ll', 'j', 'q')
+
+        if conv in 'di':
+            out.append((spec + 'd') % args.unpack('<q' if is64 else '<i'))
+        elif conv in 'ouxX':
+            out.append((spec + conv.replace('u', 'd')) % args.unpack('<Q' if is64 else '<I'))
+        elif conv == 'c':
+            out.append((spec + 'c') % chr(args.unpack('<I') & 0xff))
+        elif conv == 'p':
+            out.append('0x%x' % args.unpack('<I'))
+        elif conv == 's':
+            out.append((spec + 's') % args.string())
+        elif conv in 'aA':
+            value = float.hex(args.unpack('<d'))
+            out.append(value.upper() if conv == 'A' else value)
+        else:
+            out.append((spec + conv) % args.unpack('<d'))
+    out.append(fmt[last:])
+    return ''.join(out)
+
+
+def unescape(data, pos, count):
+    """ Unescape count bytes of data from pos, returns them with the position after them, or None if data is too short """
+    out = bytearray()
+    while len(out) < count:
+        if pos >= len(data):
+            return None
+        c = data[pos:pos + 1]
+        if c[0] == ESC:
+            if pos + 1 >= len(data):
+                return None
+            out.append(data[pos + 1:pos + 2][0] ^ ESC_XOR)
+            pos += 2
+        else:
+            out += c
+            pos += 1
+    return bytes(out), pos
+
+
+class Decoder(object):
+    def __init__(self, formats, output, timestamps=False):
+        self.formats = formats
+        self.output = output
+        self.timestamps = timestamps
+        self.text_decoder = codecs.getincrementaldecoder('utf-8')('replace')
+        self.buf = b''
+
+    def write_text(self, data, final=False):
+        self.output.write(self.text_decoder.decode(data, final))
+
+    def feed(self, data):
+        self.buf += data
+        while True:
+            start = self.buf.find(MAGIC)
+            if start < 0:
+                # Keep a trailing 0xFF, it may be the start of a record
+                keep = 1 if self.buf.endswith(MAGIC[:1]) else 0
+                self.write_text(self.buf[:len(self.buf) - keep])
+                self.buf = self.buf[len(self.buf) - keep:]
+                break
+            self.write_text(self.buf[:start])
+            self.buf = self.buf[start:]
+            header = unescape(self.buf, len(MAGIC), HEADER.size)
+            if header is None:
+                break
+            length, offset, timestamp = HEADER.unpack(header[0])
+            record = unescape(self.buf, len(MAGIC), 2 + length)
+            if record is None:
+                break
+            record, end = record
+            args = ArgReader(record[HEADER.size:])
+            try:
+                text = format_record(self.formats.get(offset), args)
+                if self.timestamps:
+                    text = '[%10u] %s' % (timestamp, text)
+            except (DecodeError, TypeError, ValueError) as e:
+                text = '[log record at offset 0x%x could not be decoded: %s]\n' % (offset, e)
+            self.output.write(text)
+            self.buf = self.buf[end:]
+        self.output.flush()
+
+    def close(self):
+        self.write_text(self.buf, True)
+        self.buf = b''
+        self.output.flush()
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Expand binary user app logs of a privilege-separation app')
+    parser.add_argument(
+        '--elf',
+        required=True,
+        type=argparse.FileType('rb'),
+        help='Path to user_app.elf, e.g. build/user_app/user_app.elf'
+    )
+    parser.add_argument(
+        '--port',
+        help='Serial port to read the console output from'
+    )
+    parser.add_argument(
+        '--baud',
+        type=int,
+        default=115200,
+        help='Baud rate of the serial port'
+    )
+    parser.add_argument(
+        '--timestamps',
+        action='store_true',
+        help='Prefix each record with its timestamp, in milliseconds'
+    )
+    parser.add_argument(
+        'input',
+        nargs='?',
+        type=argparse.FileType('rb'),
+        help='Captured console output, read from stdin if neither this nor --port is given'
+    )
+    args = parser.parse_args()
+
+    decoder = Decoder(FormatTable(args.elf), sys.stdout, args.timestamps)
+    if args.port:
+        import serial
+        with serial.Serial(args.port, args.baud, timeout=0.1) as port:
+            try:
+                while True:
+                    decoder.feed(port.read(max(1, port.in_waiting)))
+            except KeyboardInterrupt:
+                pass
+    else:
+        stream = args.input or getattr(sys.stdin, 'buffer', sys.stdin)
+        read = getattr(stream, 'read1', stream.read)
+        while True:
+            data = read(4096)
+            if not data:
+                break
+            decoder.feed(data)
+    decoder.close()
+
+
+if __name__ == '__main__':
+    main()